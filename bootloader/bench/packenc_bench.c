@@ -0,0 +1,133 @@
+// Host benchmark comparing the byte at a time packet encoder/decoder
+// with the span based versions.  Also checks they produce the same results.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "packenc.h"
+#include "crc32.h"
+
+#define PAYLOAD_SIZE    65536
+#define ITERATIONS      200
+
+static uint8_t payload[PAYLOAD_SIZE];
+static uint8_t encoded[PAYLOAD_SIZE * 2 + 64];
+static uint32_t encoded_length;
+static uint8_t decode_buf[PAYLOAD_SIZE];
+static int packets_decoded;
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char* name, double seconds)
+{
+    double mb = (double)PAYLOAD_SIZE * ITERATIONS / (1024 * 1024);
+    printf("  %-24s %8.1f MB/s\n", name, mb / seconds);
+}
+
+static void on_byte(uint8_t data)
+{
+    encoded[encoded_length++] = data;
+}
+
+static void on_span(const void* pData, uint32_t cbData)
+{
+    memcpy(encoded + encoded_length, pData, cbData);
+    encoded_length += cbData;
+}
+
+static void on_packet(uint32_t seq, uint32_t cmd, const void* pData, uint32_t cbData)
+{
+    if (cbData != PAYLOAD_SIZE || memcmp(pData, payload, cbData) != 0)
+    {
+        fprintf(stderr, "decoded packet doesn't match\n");
+        exit(1);
+    }
+    packets_decoded++;
+}
+
+static void on_error(int code)
+{
+    fprintf(stderr, "decode error %i\n", code);
+    exit(1);
+}
+
+int main()
+{
+    crc32_init();
+
+    // Random data with the occasional signal byte that needs stuffing
+    srand(1);
+    for (int i=0; i<PAYLOAD_SIZE; i++)
+        payload[i] = (rand() % 64) == 0 ? 0xAA : rand();
+
+    // Encode byte at a time
+    double start = now();
+    for (int i=0; i<ITERATIONS; i++)
+    {
+        encoded_length = 0;
+        packet_encode(on_byte, i, 3, payload, PAYLOAD_SIZE);
+    }
+    double encode_bytes = now() - start;
+    uint32_t length_bytes = encoded_length;
+    uint8_t* copy = malloc(length_bytes);
+    memcpy(copy, encoded, length_bytes);
+
+    // Encode spans
+    start = now();
+    for (int i=0; i<ITERATIONS; i++)
+    {
+        encoded_length = 0;
+        packet_encode_buf(on_span, i, 3, payload, PAYLOAD_SIZE);
+    }
+    double encode_spans = now() - start;
+    if (encoded_length != length_bytes || memcmp(copy, encoded, length_bytes) != 0)
+    {
+        fprintf(stderr, "packet_encode_buf output doesn't match packet_encode\n");
+        return 1;
+    }
+    free(copy);
+
+    // Decode byte at a time
+    decode_context ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.onPacket = on_packet;
+    ctx.onError = on_error;
+    ctx.pBuf = decode_buf;
+    ctx.cbBuf = sizeof(decode_buf);
+    start = now();
+    for (int i=0; i<ITERATIONS; i++)
+    {
+        for (uint32_t j=0; j<encoded_length; j++)
+            packet_decode(&ctx, encoded[j]);
+    }
+    double decode_bytes = now() - start;
+
+    // Decode spans
+    start = now();
+    for (int i=0; i<ITERATIONS; i++)
+        packet_decode_buf(&ctx, encoded, encoded_length);
+    double decode_spans = now() - start;
+
+    if (packets_decoded != ITERATIONS * 2)
+    {
+        fprintf(stderr, "expected %i packets, decoded %i\n", ITERATIONS * 2, packets_decoded);
+        return 1;
+    }
+
+    printf("Encode (%i x %i bytes):\n", ITERATIONS, PAYLOAD_SIZE);
+    report("packet_encode", encode_bytes);
+    report("packet_encode_buf", encode_spans);
+    printf("  speedup %.1fx\n", encode_bytes / encode_spans);
+    printf("Decode:\n");
+    report("packet_decode", decode_bytes);
+    report("packet_decode_buf", decode_spans);
+    printf("  speedup %.1fx\n", decode_bytes / decode_spans);
+    return 0;
+}
@@ -9,6 +9,9 @@
 
 
 
+// Images are read in 1MB chunks so progress can be reported
+#define load_chunk_size 0x100000
+
 // Load chain boot image
 int load_chain_image_file(const char* filename, void (*progress)())
 {
@@ -23,20 +26,26 @@ int load_chain_image_file(const char* filename, void (*progress)())
     }
 
     // Read file
-    UINT bytes_read;
     uint8_t* p = (uint8_t*)(size_t)BASE_ADDRESS;
+    uint32_t remaining = f_size(&file);
     int led = 0;
-    while (true)
+
+    while (remaining)
     {
         set_activity_led(led ^= 1);
-        err = f_read(&file, p, 4096, &bytes_read);
+        uint32_t chunk = remaining < load_chunk_size ? remaining : load_chunk_size;
+        UINT bytes_read;
+        err = f_read(&file, p, chunk, &bytes_read);
         if (err)
             break;
-
-        if (bytes_read < 4096)
+        if (bytes_read != chunk)
+        {
+            err = -1;
             break;
+        }
+        p += chunk;
+        remaining -= chunk;
 
-        p += bytes_read;
         if (progress)
             progress();
     }
@@ -49,6 +58,70 @@ int load_chain_image_file(const char* filename, void (*progress)())
     return 0;
 }
 
+// Load a segmented image file, consisting of a sequence of load address 
+// and length headers, each followed by that many bytes of data
+int load_segmented_image_file(const char* filename, void (*progress)())
+{
+    trace("Loading %s\n", filename);
+
+    // Open the file
+    FIL file;
+    int err = f_open(&file, filename, FA_READ | FA_OPEN_EXISTING);
+    if (err)
+    {
+        return err;
+    }
+
+    // Read segments
+    int led = 0;
+    while (true)
+    {
+        set_activity_led(led ^= 1);
+
+        // Read segment header
+        uint32_t header[2];
+        UINT bytes_read;
+        err = f_read(&file, header, sizeof(header), &bytes_read);
+        if (err || bytes_read == 0)
+            break;
+        if (bytes_read != sizeof(header))
+        {
+            err = -1;
+            break;
+        }
+
+        // Check it's in the load region
+        if (header[0] >= max_load_address || header[1] > max_load_address - header[0])
+        {
+            err = -1;
+            break;
+        }
+
+        // Read segment data straight to its load address (in 1MB chunks
+        // so progress can be reported)
+        uint8_t* pDest = (uint8_t*)(size_t)header[0];
+        uint32_t remaining = header[1];
+        while (remaining && !err)
+        {
+            uint32_t chunk = remaining < load_chunk_size ? remaining : load_chunk_size;
+            err = f_read(&file, pDest, chunk, &bytes_read);
+            if (!err && bytes_read != chunk)
+                err = -1;
+            pDest += chunk;
+            remaining -= chunk;
+
+            if (progress)
+                progress();
+        }
+        if (err)
+            break;
+    }
+    set_activity_led(0);
+    f_close(&file);
+
+    return err;
+}
+
 // Get the kernel suffixes for a particular pi model
 const char** kernel_suffixes_for_model(int model)
 {
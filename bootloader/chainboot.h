@@ -1,4 +1,5 @@
 #pragma once
 
 int load_chain_image(const char* filename, void (*progress)());
+int load_segmented_image_file(const char* filename, void (*progress)());
 void run_chain_image();
@@ -27,6 +27,8 @@ int cmd_time(struct PROCESS* proc)
 
     pout("elapsed: %li\ndisk read: %li\ndisk write: %li\nserial write: %li\n", 
         last_elapsed_time, last_disk_read_time, last_disk_write_time, last_serial_write_time);
+    pout("sector cache hits: %i\nsector cache misses: %i\n",
+        last_sector_cache_hits, last_sector_cache_misses);
 
 
     return 0;
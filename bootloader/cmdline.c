@@ -2,6 +2,23 @@
 
 uint32_t cl_autochain_timeout_millis = 10000;
 const char* cl_autochain_target = NULL;
+uint32_t cl_sector_cache_size = 256;
+
+// Parse a decimal number
+static bool parse_uint32(const char* value, uint32_t* pResult)
+{
+    uint32_t result = 0;
+    if (!*value)
+        return false;
+    for (; *value; value++)
+    {
+        if (*value < '0' || *value > '9')
+            return false;
+        result = result * 10 + (*value - '0');
+    }
+    *pResult = result;
+    return true;
+}
 
 void process_cmdline_autochain(char* value)
 {    
@@ -49,6 +66,10 @@ void process_cmdline()
             {
                 process_cmdline_autochain(value);
             }
+            if (strcmp(tokenizer.arg, "flashy.sectorcache") == 0 && value)
+            {
+                parse_uint32(value, &cl_sector_cache_size);
+            }
         }
         tokenizer_next(&tokenizer);
     }
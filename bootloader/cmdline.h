@@ -2,5 +2,6 @@
 
 extern uint32_t cl_autochain_timeout_millis;
 extern const char* cl_autochain_target;
+extern uint32_t cl_sector_cache_size;
 
 void process_cmdline();
\ No newline at end of file
@@ -14,11 +14,17 @@
 // Packed structure
 #define PACKED __attribute__((__packed__))
 
-// Maximum supported packet size
-#define max_packet_size 4096
+// Packet size used until the host requests a different size (with
+// PACKET_ID_REQUEST_BAUD), and the largest that can be requested
+#define default_packet_size 4096
+#define max_packet_size_limit 65536
+
+// Data packets can be loaded anywhere below the relocated bootloader
+#define max_load_address 0x07C00000
 
 // Shared globals
-extern uint8_t response_buf[max_packet_size];
+extern uint32_t max_packet_size;
+extern uint8_t* response_buf;
 extern uint32_t min_cpu_freq;
 extern uint32_t max_cpu_freq;
 extern uint32_t reset_timeout_millis;
@@ -29,8 +35,13 @@ extern uint64_t last_disk_read_time;
 extern uint64_t last_disk_write_time;
 extern uint64_t last_elapsed_time;
 extern uint64_t last_serial_write_time;
+extern uint32_t last_sector_cache_hits;
+extern uint32_t last_sector_cache_misses;
 
 extern uint64_t serial_write_time;
+extern uint32_t last_seq;
+
+void set_max_packet_size(uint32_t size);
 
 // Packets ID
 enum PACKET_ID
@@ -49,21 +60,53 @@ enum PACKET_ID
     PACKET_ID_PULL_DATA = 11,
     PACKET_ID_PUSH_DATA = 12,
     PACKET_ID_PUSH_COMMIT = 13,
+    PACKET_ID_NAK = 14,
+    PACKET_ID_DATA_COMPRESSED = 15,
+    PACKET_ID_FILL = 16,
+    PACKET_ID_DATA_MULTI = 17,
+    PACKET_ID_MEMORY_CRC = 18,
+    PACKET_ID_BLOCK_CRC = 19,
+    PACKET_ID_CACHE_LOAD = 20,
+    PACKET_ID_CACHE_STORE = 21,
+    PACKET_ID_LIST = 22,
+    PACKET_ID_LIST_DATA = 23,
+    PACKET_ID_PULL_MANY = 24,
+    PACKET_ID_PUSH_ARCHIVE = 25,
+    PACKET_ID_FILE_CRC = 26,
 
 };
 
 // Shared functions
 void sendPacket(uint32_t seq, uint32_t id, const void* pData, uint32_t cbData);
+bool accept_stream_packet(uint32_t seq, const void* pAck, uint32_t cbAck);
 void restore_cpu_freq();
 
 // Handlers
 void handle_ping(uint32_t seq, const void* p, uint32_t cb);
 void handle_data(uint32_t seq, const void* p, uint32_t cb);
+void handle_data_compressed(uint32_t seq, const void* p, uint32_t cb);
+void handle_fill(uint32_t seq, const void* p, uint32_t cb);
+void handle_data_multi(uint32_t seq, const void* p, uint32_t cb);
+void handle_memory_crc(uint32_t seq, const void* p, uint32_t cb);
+void handle_block_crc(uint32_t seq, const void* p, uint32_t cb);
+void handle_cache_load(uint32_t seq, const void* p, uint32_t cb);
+void handle_cache_store(uint32_t seq, const void* p, uint32_t cb);
+void cache_record(uint32_t address, uint32_t length);
+void handle_list(uint32_t seq, const void* p, uint32_t cb);
+void handle_pull_many(uint32_t seq, const void* p, uint32_t cb);
+void handle_file_crc(uint32_t seq, const void* p, uint32_t cb);
+
+// Directory enumeration (handle_list.c)
+typedef int (*ENUM_ENTRY_CALLBACK)(const char* path, const char* name, const FILINFO* pfi);
+int enum_directory(const char* path, const char* pattern, bool recursive, ENUM_ENTRY_CALLBACK callback);
+const char* list_packet_pattern(const void* p, uint32_t cb);
+void* redirect_data(uint32_t seq, uint32_t cmd, const void* pHeader, uint32_t cbData);
 void handle_baud_request(uint32_t seq, const void* p, uint32_t cb);
 void handle_go(uint32_t seq, const void* p, uint32_t cb);
 void handle_pull(uint32_t seq, const void* p, uint32_t cb);
 void handle_push_data(uint32_t seq, const void* p, uint32_t cb);
 void handle_push_commit(uint32_t seq, const void* p, uint32_t cb);
+void handle_push_archive(uint32_t seq, const void* p, uint32_t cb);
 void reset_push();
 void handle_command(uint32_t seq, const void* p, uint32_t cb);
 void finish_handle_command(struct PROCESS* proc);
@@ -1,6 +1,31 @@
 #include "crc32.h"
 
-static uint32_t g_dwCRCTable[256];
+// Use the ARMv8 CRC32 instructions on aarch64 (which implement the same
+// polynomial), otherwise use table lookups, 8 bytes at a time
+#ifndef CRC32_HW
+#if AARCH == 64
+#define CRC32_HW 1
+#else
+#define CRC32_HW 0
+#endif
+#endif
+
+#if CRC32_HW
+
+// The bootloader is built without -mcpu, so enable the crc extension here
+#pragma GCC target ("+crc")
+#include <arm_acle.h>
+
+void crc32_init()
+{
+	// Nothing to do
+}
+
+#else
+
+// g_dwCRCTable[0] is the standard byte at a time table, [1..7] are
+// for the following bytes when processing 8 bytes at a time
+static uint32_t g_dwCRCTable[8][256];
 static bool  g_bInitialized=false;
 
 // Reflection is a requirement for the official CRC-32 standard.
@@ -36,34 +61,110 @@ void crc32_init()
 	// 256 values representing ASCII character codes.
 	for(int i = 0; i <= 0xFF; i++)
 	{
-		g_dwCRCTable[i]=crc32_reflect(i, 8) << 24;
+		g_dwCRCTable[0][i]=crc32_reflect(i, 8) << 24;
 		for (int j = 0; j < 8; j++)
-			g_dwCRCTable[i] = (g_dwCRCTable[i] << 1) ^ (g_dwCRCTable[i] & (1 << 31) ? ulPolynomial : 0);
-		g_dwCRCTable[i] = crc32_reflect(g_dwCRCTable[i], 32);
+			g_dwCRCTable[0][i] = (g_dwCRCTable[0][i] << 1) ^ (g_dwCRCTable[0][i] & (1 << 31) ? ulPolynomial : 0);
+		g_dwCRCTable[0][i] = crc32_reflect(g_dwCRCTable[0][i], 32);
+	}
+
+	// Slicing tables
+	for(int i = 0; i <= 0xFF; i++)
+	{
+		for (int t = 1; t < 8; t++)
+			g_dwCRCTable[t][i] = (g_dwCRCTable[t-1][i] >> 8) ^ g_dwCRCTable[0][g_dwCRCTable[t-1][i] & 0xFF];
 	}
 }
 
+#endif
+
 void crc32_start(uint32_t* pcrc)
 {
-	// Make sure initialised
-	crc32_init();
 	*pcrc = 0xFFFFFFFF;
 }
 
+#if CRC32_HW
+
 void crc32_update_1(uint32_t* pcrc, uint8_t byte)
 {
-	*pcrc = (*pcrc >> 8) ^ g_dwCRCTable[(*pcrc & 0xFF) ^ byte];
+	*pcrc = __crc32b(*pcrc, byte);
 }
 
 void crc32_update(uint32_t* pcrc, const void* pbDataIn, int cbData)
 {
 	const unsigned char* pbData=(const unsigned char*)pbDataIn;
-	while(cbData--)
+	uint32_t crc = *pcrc;
+
+	// Bytes up to 8 byte alignment (built with strict alignment)
+	while (cbData && ((uintptr_t)pbData & 7))
 	{
-		*pcrc = (*pcrc >> 8) ^ g_dwCRCTable[(*pcrc & 0xFF) ^ *pbData++];
+		crc = __crc32b(crc, *pbData++);
+		cbData--;
 	}
+
+	// 8 bytes at a time
+	while (cbData >= 8)
+	{
+		crc = __crc32d(crc, *(const uint64_t*)pbData);
+		pbData += 8;
+		cbData -= 8;
+	}
+
+	// Remaining bytes
+	while (cbData--)
+	{
+		crc = __crc32b(crc, *pbData++);
+	}
+
+	*pcrc = crc;
 }
 
+#else
+
+void crc32_update_1(uint32_t* pcrc, uint8_t byte)
+{
+	*pcrc = (*pcrc >> 8) ^ g_dwCRCTable[0][(*pcrc & 0xFF) ^ byte];
+}
+
+void crc32_update(uint32_t* pcrc, const void* pbDataIn, int cbData)
+{
+	const unsigned char* pbData=(const unsigned char*)pbDataIn;
+	uint32_t crc = *pcrc;
+
+	// Bytes up to 4 byte alignment (built with strict alignment)
+	while (cbData && ((uintptr_t)pbData & 3))
+	{
+		crc = (crc >> 8) ^ g_dwCRCTable[0][(crc & 0xFF) ^ *pbData++];
+		cbData--;
+	}
+
+	// 8 bytes at a time (little endian)
+	while (cbData >= 8)
+	{
+		uint32_t one = ((const uint32_t*)pbData)[0] ^ crc;
+		uint32_t two = ((const uint32_t*)pbData)[1];
+		crc = g_dwCRCTable[7][one & 0xFF] ^
+			g_dwCRCTable[6][(one >> 8) & 0xFF] ^
+			g_dwCRCTable[5][(one >> 16) & 0xFF] ^
+			g_dwCRCTable[4][one >> 24] ^
+			g_dwCRCTable[3][two & 0xFF] ^
+			g_dwCRCTable[2][(two >> 8) & 0xFF] ^
+			g_dwCRCTable[1][(two >> 16) & 0xFF] ^
+			g_dwCRCTable[0][two >> 24];
+		pbData += 8;
+		cbData -= 8;
+	}
+
+	// Remaining bytes
+	while (cbData--)
+	{
+		crc = (crc >> 8) ^ g_dwCRCTable[0][(crc & 0xFF) ^ *pbData++];
+	}
+
+	*pcrc = crc;
+}
+
+#endif
+
 void crc32_finish(uint32_t* pcrc)
 {
 	// Exclusive OR the result with the beginning value.
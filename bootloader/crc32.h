@@ -7,6 +7,7 @@
 extern "C" {
 #endif
 
+void crc32_init();
 void crc32_start(uint32_t* pcrc);
 void crc32_update_1(uint32_t* pcrc, uint8_t byte);
 void crc32_update(uint32_t* pcrc, const void* pData, int cbData);
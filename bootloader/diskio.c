@@ -1,7 +1,10 @@
 #include <time.h>
+#include <string.h>
+#include <malloc.h>
 
 #include "raspi.h"
 #include "sdcard.h"
+#include "cmdline.h"
 
 #include <ff.h>
 #include <diskio.h>
@@ -10,6 +13,73 @@ const char* VolumeStr[FF_VOLUMES] = { "sd" };
 
 uint64_t disk_read_time = 0;
 uint64_t disk_write_time = 0;
+uint32_t sector_cache_hits = 0;
+uint32_t sector_cache_misses = 0;
+
+// Sector cache.  A write-through cache of recently used sectors for the
+// single sector reads FatFS makes of the FAT and directories.  Multi-sector
+// reads (file data) bypass the cache, but writes always update it so
+// it's never stale.
+typedef struct
+{
+    LBA_t sector;
+    uint32_t last_used;         // LRU clock when last used, 0 if empty
+} SECTOR_CACHE_ENTRY;
+
+static SECTOR_CACHE_ENTRY* sector_cache = NULL;
+static uint8_t* sector_cache_data = NULL;
+static uint32_t sector_cache_count = 0;
+static uint32_t sector_cache_clock = 0;
+
+// Allocate the sector cache
+static void sector_cache_init()
+{
+    if (sector_cache || cl_sector_cache_size == 0)
+        return;
+
+    sector_cache = (SECTOR_CACHE_ENTRY*)malloc(cl_sector_cache_size * sizeof(SECTOR_CACHE_ENTRY));
+    sector_cache_data = (uint8_t*)malloc(cl_sector_cache_size * FF_MAX_SS);
+    if (sector_cache == NULL || sector_cache_data == NULL)
+    {
+        free(sector_cache);
+        free(sector_cache_data);
+        sector_cache = NULL;
+        sector_cache_data = NULL;
+        return;
+    }
+
+    sector_cache_count = cl_sector_cache_size;
+    memset(sector_cache, 0, sector_cache_count * sizeof(SECTOR_CACHE_ENTRY));
+}
+
+// Find a sector in the cache, returns its index or -1
+static int sector_cache_find(LBA_t sector)
+{
+    for (uint32_t i=0; i<sector_cache_count; i++)
+    {
+        if (sector_cache[i].last_used && sector_cache[i].sector == sector)
+            return i;
+    }
+    return -1;
+}
+
+// Add a sector to the cache, replacing the least recently used entry
+static void sector_cache_add(LBA_t sector, const BYTE* buff)
+{
+    if (sector_cache_count == 0)
+        return;
+
+    uint32_t lru = 0;
+    for (uint32_t i=1; i<sector_cache_count; i++)
+    {
+        if (sector_cache[i].last_used < sector_cache[lru].last_used)
+            lru = i;
+    }
+
+    sector_cache[lru].sector = sector;
+    sector_cache[lru].last_used = ++sector_cache_clock;
+    memcpy(sector_cache_data + lru * FF_MAX_SS, buff, FF_MAX_SS);
+}
 
 // FatFS file system object
 FATFS g_fs;
@@ -26,6 +96,20 @@ DSTATUS disk_status(BYTE pdrv)
 
 DRESULT disk_read(BYTE pdrv, BYTE* buff, LBA_t sector, UINT count)
 {
+    // Cached?
+    if (count == 1 && sector_cache_count)
+    {
+        int index = sector_cache_find(sector);
+        if (index >= 0)
+        {
+            sector_cache[index].last_used = ++sector_cache_clock;
+            memcpy(buff, sector_cache_data + index * FF_MAX_SS, FF_MAX_SS);
+            sector_cache_hits++;
+            return RES_OK;
+        }
+        sector_cache_misses++;
+    }
+
     uint64_t start_time = micros();
     int err = read_sdcard(sector, count, buff);
     disk_read_time += micros() - start_time;
@@ -33,6 +117,10 @@ DRESULT disk_read(BYTE pdrv, BYTE* buff, LBA_t sector, UINT count)
     {
         return RES_ERROR;
     }
+
+    // Cache single sector reads
+    if (count == 1)
+        sector_cache_add(sector, buff);
     
     return RES_OK;    
 }
@@ -42,6 +130,19 @@ DRESULT disk_write(BYTE pdrv, const BYTE* buff, LBA_t sector, UINT count)
     uint64_t start_time = micros();
     int err = write_sdcard(sector, count, buff);
     disk_write_time += micros() - start_time;
+
+    // Update (or if failed, discard) any cached copies of the written sectors
+    for (uint32_t i=0; i<sector_cache_count; i++)
+    {
+        if (sector_cache[i].last_used && sector_cache[i].sector >= sector && sector_cache[i].sector - sector < count)
+        {
+            if (err)
+                sector_cache[i].last_used = 0;
+            else
+                memcpy(sector_cache_data + i * FF_MAX_SS, buff + (sector_cache[i].sector - sector) * FF_MAX_SS, FF_MAX_SS);
+        }
+    }
+
     if (err)
     {
         return RES_ERROR;
@@ -94,6 +195,9 @@ int mount_sdcard()
     if (err)
         return 1000 + err;
 
+    // Setup sector cache
+    sector_cache_init();
+
     // Mount it
     err = f_mount(&g_fs, "", 1);
     if (err)
@@ -1,6 +1,9 @@
     #include "raspi.h"
+#include <ff.h>
 
 int mount_sdcard();
 
 extern uint64_t disk_read_time;
 extern uint64_t disk_write_time;
+extern uint32_t sector_cache_hits;
+extern uint32_t sector_cache_misses;
@@ -10,14 +10,30 @@ typedef struct PACKED
     uint32_t baud;
     uint32_t reset_timeout_millis;
     uint32_t cpufreq;
+    uint32_t window;            // requested number of packets in flight
+    uint32_t packet_size;       // requested maximum packet size
 } PACKET_REQUEST_BAUD;
 
+// Request baud ack packet
+// device -> host
+typedef struct PACKED
+{
+    uint32_t window;            // granted number of packets in flight
+    uint32_t packet_size;       // granted maximum packet size
+} PACKET_REQUEST_BAUD_ACK;
+
+
 
 void handle_baud_request(uint32_t seq, const void* p, uint32_t cb)
 {
     // Cast packet
     PACKET_REQUEST_BAUD* pBaud = (PACKET_REQUEST_BAUD*)p;
 
+    // Older hosts don't send a window or packet size
+    uint32_t baud = pBaud->baud;
+    uint32_t window = cb >= offsetof(PACKET_REQUEST_BAUD, packet_size) ? pBaud->window : 1;
+    uint32_t packet_size = cb >= sizeof(PACKET_REQUEST_BAUD) ? pBaud->packet_size : default_packet_size;
+
     // Store reset
     reset_timeout_millis = pBaud->reset_timeout_millis;
 
@@ -38,15 +54,31 @@ void handle_baud_request(uint32_t seq, const void* p, uint32_t cb)
         set_cpu_freq(pBaud->cpufreq);
     }
 
+    // Resize packet buffers (pBaud is invalid after this)
+    set_max_packet_size(packet_size);
+
+    // Work out how many packets the host can have in flight.  While one is
+    // being handled the rest wait in the uart receive buffer so allow for
+    // worst case byte stuffing.
+    PACKET_REQUEST_BAUD_ACK ack;
+    uint32_t encoded_size = max_packet_size + max_packet_size / 2 + 32;
+    ack.window = UART_RX_BUFFER_MAX / encoded_size;
+    if (window < ack.window)
+        ack.window = window;
+    if (ack.window < 1)
+        ack.window = 1;
+    ack.packet_size = max_packet_size;
+    uart_set_rx_buffer_size(ack.window * encoded_size);
+
     // Send ack
-    sendPacket(seq, PACKET_ID_ACK, NULL, 0);
+    sendPacket(seq, PACKET_ID_ACK, &ack, sizeof(ack));
 
-    if (pBaud->baud != current_baud)
+    if (baud != current_baud)
     {
         // Switch baud rate
         uart_flush();
         delay_millis(10);
-        current_baud = pBaud->baud;
+        current_baud = baud;
         uart_init(current_baud);
     }
 }
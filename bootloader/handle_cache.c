@@ -0,0 +1,312 @@
+#include "common.h"
+#include "chainboot.h"
+#include "../lib/FFsh/FFsh/src/ffex.h"
+
+// Cache load packet
+// host -> device - packet data is the null terminated name of a cache 
+// entry to load from the SD card.  If it's not in the cache, the device 
+// starts recording the memory ranges written by the upload that follows.
+
+// Cache store packet
+// host -> device - stores the memory ranges written since the cache load 
+// request to the cache
+typedef struct PACKED
+{
+    uint32_t max_cache_size;    // Least recently used entries are evicted to stay under this size
+    char name[];                // Null terminated cache entry name
+} PACKET_CACHE_STORE;
+
+#define cache_dir "/sd/flashy_cache"
+#define cache_temp_filename "/sd/flashy_cache/cache.tmp"
+
+// A range of memory written by the host
+typedef struct
+{
+    uint32_t address;
+    uint32_t length;
+} CACHE_RANGE;
+
+// Memory ranges written since recording started
+static bool cache_recording = false;
+static CACHE_RANGE* cache_ranges = NULL;
+static uint32_t cache_range_count = 0;
+static uint32_t cache_range_capacity = 0;
+
+// Discard recorded ranges
+static void cache_reset_ranges()
+{
+    if (cache_ranges)
+        free(cache_ranges);
+    cache_ranges = NULL;
+    cache_range_count = 0;
+    cache_range_capacity = 0;
+}
+
+// Record a range of memory written by the host while a cache entry is 
+// being recorded
+void cache_record(uint32_t address, uint32_t length)
+{
+    if (!cache_recording || length == 0)
+        return;
+
+    // Extend the previous range if contiguous
+    if (cache_range_count && cache_ranges[cache_range_count-1].address + cache_ranges[cache_range_count-1].length == address)
+    {
+        cache_ranges[cache_range_count-1].length += length;
+        return;
+    }
+
+    // Grow the list
+    if (cache_range_count == cache_range_capacity)
+    {
+        uint32_t capacity = cache_range_capacity ? cache_range_capacity * 2 : 64;
+        CACHE_RANGE* pNew = (CACHE_RANGE*)malloc(capacity * sizeof(CACHE_RANGE));
+        if (!pNew)
+        {
+            // Out of memory, give up on this entry
+            cache_reset_ranges();
+            cache_recording = false;
+            return;
+        }
+        if (cache_ranges)
+        {
+            memcpy(pNew, cache_ranges, cache_range_count * sizeof(CACHE_RANGE));
+            free(cache_ranges);
+        }
+        cache_ranges = pNew;
+        cache_range_capacity = capacity;
+    }
+
+    cache_ranges[cache_range_count].address = address;
+    cache_ranges[cache_range_count].length = length;
+    cache_range_count++;
+}
+
+// Sort the recorded ranges by address and merge overlapping and 
+// adjacent ranges (ranges are usually already in order so an 
+// insertion sort is fine)
+static void cache_merge_ranges()
+{
+    for (uint32_t i=1; i<cache_range_count; i++)
+    {
+        CACHE_RANGE r = cache_ranges[i];
+        uint32_t j = i;
+        while (j > 0 && cache_ranges[j-1].address > r.address)
+        {
+            cache_ranges[j] = cache_ranges[j-1];
+            j--;
+        }
+        cache_ranges[j] = r;
+    }
+
+    uint32_t count = 0;
+    for (uint32_t i=0; i<cache_range_count; i++)
+    {
+        if (count)
+        {
+            CACHE_RANGE* pPrev = &cache_ranges[count-1];
+            uint32_t prevEnd = pPrev->address + pPrev->length;
+            if (cache_ranges[i].address <= prevEnd)
+            {
+                uint32_t end = cache_ranges[i].address + cache_ranges[i].length;
+                if (end > prevEnd)
+                    pPrev->length = end - pPrev->address;
+                continue;
+            }
+        }
+        cache_ranges[count++] = cache_ranges[i];
+    }
+    cache_range_count = count;
+}
+
+// Get the filename of a cache entry
+static int cache_filename(const char* name, char* psz)
+{
+    if (strlen(name) == 0 || strlen(name) + sizeof(cache_dir) + 6 > FF_MAX_LFN || strchr(name, '/'))
+        return -1;
+    strcpy(psz, cache_dir);
+    strcat(psz, "/");
+    strcat(psz, name);
+    strcat(psz, ".bin");
+    return 0;
+}
+
+// Delete the least recently used cache entries until the total size of 
+// the cache is no more than max_size
+static int cache_evict(uint32_t max_size)
+{
+    while (true)
+    {
+        // Find the total size and the oldest entry
+        DIR dir;
+        int err = f_opendir(&dir, cache_dir);
+        if (err)
+            return err;
+
+        uint64_t total = 0;
+        uint32_t oldestTime = 0xFFFFFFFF;
+        char szOldest[FF_MAX_LFN];
+        szOldest[0] = '\0';
+        FILINFO fi;
+        while (f_readdir(&dir, &fi) == 0 && fi.fname[0])
+        {
+            // Only cache entries
+            size_t len = strlen(fi.fname);
+            if ((fi.fattrib & AM_DIR) || len < 4 || strcmp(fi.fname + len - 4, ".bin") != 0)
+                continue;
+
+            total += fi.fsize;
+
+            uint32_t time = (uint32_t)fi.fdate << 16 | fi.ftime;
+            if (time < oldestTime)
+            {
+                oldestTime = time;
+                strcpy(szOldest, fi.fname);
+            }
+        }
+        f_closedir(&dir);
+
+        // Small enough?
+        if (total <= max_size || szOldest[0] == '\0')
+            return 0;
+
+        // Delete the oldest
+        char sz[FF_MAX_LFN];
+        strcpy(sz, cache_dir);
+        pathcat(sz, szOldest);
+        err = f_unlink(sz);
+        if (err)
+            return err;
+    }
+}
+
+// Sequence number of the cache load request being processed
+static uint32_t cache_load_seq = 0;
+
+// Send an empty stdout packet while loading to stop the host timing out
+static void cache_load_progress()
+{
+    sendPacket(cache_load_seq, PACKET_ID_STDOUT, NULL, 0);
+}
+
+static int handle_cache_load_internal(uint32_t seq, const void* p, uint32_t cb)
+{
+    // Crack packet
+    const char* name = (const char*)p;
+
+    // Stop any previous recording
+    cache_recording = false;
+    cache_reset_ranges();
+
+    // Make sure card mounted
+    int err = mount_sdcard();
+    if (err)
+        return err;
+
+    // Work out file name
+    char szFile[FF_MAX_LFN];
+    err = cache_filename(name, szFile);
+    if (err)
+        return err;
+
+    // Load it
+    cache_load_seq = seq;
+    err = load_segmented_image_file(szFile, cache_load_progress);
+    if (err)
+    {
+        // Not cached (or bad entry), record the upload instead
+        cache_recording = true;
+        return err;
+    }
+
+    // Update the file time so it's evicted last
+    FILINFO fi;
+    DWORD now = get_fattime();
+    fi.fdate = (WORD)(now >> 16);
+    fi.ftime = (WORD)now;
+    f_utime(szFile, &fi);
+
+    return 0;
+}
+
+static int handle_cache_store_internal(uint32_t seq, const void* p, uint32_t cb)
+{
+    // Crack packet
+    const PACKET_CACHE_STORE* pStore = (const PACKET_CACHE_STORE*)p;
+
+    // Stop recording
+    cache_recording = false;
+    if (cache_range_count == 0)
+        return -2;
+
+    // Work out file name
+    char szFile[FF_MAX_LFN];
+    int err = cache_filename(pStore->name, szFile);
+    if (err)
+        return err;
+
+    // Work out size of the new entry
+    cache_merge_ranges();
+    uint64_t size = 0;
+    for (uint32_t i=0; i<cache_range_count; i++)
+    {
+        size += sizeof(CACHE_RANGE) + cache_ranges[i].length;
+    }
+    if (size > pStore->max_cache_size)
+        return -3;
+
+    // Make room
+    err = mount_sdcard();
+    if (err)
+        return err;
+    f_mkdir_r(cache_dir);
+    f_unlink(szFile);
+    err = cache_evict(pStore->max_cache_size - (uint32_t)size);
+    if (err)
+        return err;
+
+    // Write the ranges to a temp file
+    FIL file;
+    err = f_open(&file, cache_temp_filename, FA_WRITE|FA_CREATE_ALWAYS);
+    if (err)
+        return err;
+
+    for (uint32_t i=0; i<cache_range_count && err == 0; i++)
+    {
+        UINT cbWritten;
+        err = f_write(&file, &cache_ranges[i], sizeof(CACHE_RANGE), &cbWritten);
+        if (!err && cbWritten != sizeof(CACHE_RANGE))
+            err = -4;
+        if (!err)
+            err = f_write(&file, (const void*)(size_t)cache_ranges[i].address, cache_ranges[i].length, &cbWritten);
+        if (!err && cbWritten != cache_ranges[i].length)
+            err = -4;
+    }
+
+    int errClose = f_close(&file);
+    if (!err)
+        err = errClose;
+
+    // Move temp file to final location
+    if (!err)
+        err = f_rename(cache_temp_filename, szFile);
+    if (err)
+        f_unlink(cache_temp_filename);
+    return err;
+}
+
+void handle_cache_load(uint32_t seq, const void* p, uint32_t cb)
+{
+    set_activity_led(1);
+    int err = handle_cache_load_internal(seq, p, cb);
+    sendPacket(seq, PACKET_ID_ACK, &err, sizeof(err));
+    set_activity_led(0);
+}
+
+void handle_cache_store(uint32_t seq, const void* p, uint32_t cb)
+{
+    set_activity_led(1);
+    int err = handle_cache_store_internal(seq, p, cb);
+    sendPacket(seq, PACKET_ID_ACK, &err, sizeof(err));
+    set_activity_led(0);
+}
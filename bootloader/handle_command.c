@@ -12,6 +12,8 @@ uint64_t last_disk_read_time = 0;
 uint64_t last_disk_write_time = 0;
 uint64_t last_elapsed_time = 0;
 uint64_t last_serial_write_time = 0;
+uint32_t last_sector_cache_hits = 0;
+uint32_t last_sector_cache_misses = 0;
 
 typedef struct PACKED
 {
@@ -163,6 +165,8 @@ void handle_command(uint32_t seq, const void* p, uint32_t cb)
     disk_read_time = 0;
     disk_write_time = 0;
     serial_write_time = 0;
+    sector_cache_hits = 0;
+    sector_cache_misses = 0;
     uint64_t start_time = micros();
 
     // Setup command context
@@ -183,6 +187,8 @@ void handle_command(uint32_t seq, const void* p, uint32_t cb)
     last_disk_write_time = disk_write_time;
     last_disk_read_time = disk_read_time;
     last_serial_write_time = serial_write_time;
+    last_sector_cache_hits = sector_cache_hits;
+    last_sector_cache_misses = sector_cache_misses;
     last_elapsed_time = micros() - start_time;
 }
 
@@ -1,27 +1,212 @@
 #include "common.h"
+#include "lz4.h"
 
 // Data packet
 // host -> device - program data to be loaded
 typedef struct PACKED
 {
     uint32_t address;
+    uint32_t length;            // Length of data, must match the packet length
     uint8_t data[0];
 } PACKET_DATA;
 
+// Compressed data packet
+// host -> device - LZ4 compressed program data to be loaded
+typedef struct PACKED
+{
+    uint32_t address;
+    uint32_t length;            // Uncompressed length
+    uint8_t data[0];            // LZ4 block
+} PACKET_DATA_COMPRESSED;
+
+// Fill packet
+// host -> device - fill a region of memory with a byte value
+typedef struct PACKED
+{
+    uint32_t address;
+    uint32_t length;
+    uint8_t pattern;
+} PACKET_FILL;
+
+// Multi-segment data packet
+// host -> device - packet data is a sequence of these segments, each
+// holding program data to be loaded at a different address
+typedef struct PACKED
+{
+    uint32_t address;
+    uint32_t length;
+    uint8_t data[0];
+} DATA_SEGMENT;
+
+// Address following the last data packet, and the sequence number
+// of the packet (if any) being received directly to its load address
+static uint32_t next_address = 0;
+static uint32_t in_place_seq = 0;
+
+// Called by the packet decoder once the data packet header has been 
+// received, returns where the rest of the packet data should be written.
+// Only packets that are next in sequence, continue on from the
+// previous packet and whose data length matches the packet framing's
+// length are received in place.  A corrupt length in either place
+// fails the match, so data is only ever written inside the region this
+// packet covers.  If the data is corrupt the packet is resent and the
+// region rewritten.
+void* redirect_data(uint32_t seq, uint32_t cmd, const void* pHeader, uint32_t cbData)
+{
+    in_place_seq = 0;
+
+    if (cmd != PACKET_ID_DATA)
+        return NULL;
+
+    const PACKET_DATA* pData = (const PACKET_DATA*)pHeader;
+    if (seq != last_seq + 1 || pData->address != next_address)
+        return NULL;
+
+    // Check the length the host sent matches the framing
+    uint32_t length = cbData - sizeof(PACKET_DATA);
+    if (cbData < sizeof(PACKET_DATA) || pData->length != length)
+        return NULL;
+
+    // Check it's in the load region
+    if (pData->address >= max_load_address || length > max_load_address - pData->address)
+        return NULL;
+
+    in_place_seq = seq;
+    return (void*)(size_t)pData->address;
+}
 
 void handle_data(uint32_t seq, const void* p, uint32_t cb)
 {
+    // Ignore if out of sequence
+    int err = 0;
+    if (!accept_stream_packet(seq, &err, sizeof(err)))
+        return;
+
     // Flash activity led
     set_activity_led(1);
 
     // Cast packet
     PACKET_DATA* pData = (PACKET_DATA*)p;
 
-    // Copy packet data to memory
-    memcpy((void*)(size_t)pData->address, pData->data, cb - sizeof(PACKET_DATA));
+    // Check the length matches the packet and it's in the load region,
+    // then copy it to memory (unless already received in place)
+    uint32_t length = cb - sizeof(PACKET_DATA);
+    if (cb < sizeof(PACKET_DATA) || pData->length != length)
+        err = -2;
+    else if (pData->address >= max_load_address || length > max_load_address - pData->address)
+        err = -1;
+    else
+    {
+        if (in_place_seq != seq)
+            memcpy((void*)(size_t)pData->address, pData->data, length);
+        cache_record(pData->address, length);
+    }
+    in_place_seq = 0;
+    next_address = pData->address + pData->length;
+
+    // Send ack
+    sendPacket(seq, PACKET_ID_ACK, &err, sizeof(err));
+
+    set_activity_led(0);
+}
+
+void handle_data_compressed(uint32_t seq, const void* p, uint32_t cb)
+{
+    // Ignore if out of sequence
+    int err = 0;
+    if (!accept_stream_packet(seq, &err, sizeof(err)))
+        return;
+
+    // Flash activity led
+    set_activity_led(1);
+
+    // Cast packet
+    PACKET_DATA_COMPRESSED* pData = (PACKET_DATA_COMPRESSED*)p;
+
+    // Check it's in the load region and decompress it straight to memory
+    if (pData->address >= max_load_address || pData->length > max_load_address - pData->address)
+        err = -1;
+    else if (lz4_decompress(pData->data, cb - sizeof(PACKET_DATA_COMPRESSED), (void*)(size_t)pData->address, pData->length) != (int)pData->length)
+        err = -2;
+    else
+        cache_record(pData->address, pData->length);
+    next_address = pData->address + pData->length;
+
+    // Send ack
+    sendPacket(seq, PACKET_ID_ACK, &err, sizeof(err));
+
+    set_activity_led(0);
+}
+
+void handle_fill(uint32_t seq, const void* p, uint32_t cb)
+{
+    // Ignore if out of sequence
+    int err = 0;
+    if (!accept_stream_packet(seq, &err, sizeof(err)))
+        return;
+
+    // Flash activity led
+    set_activity_led(1);
+
+    // Cast packet
+    PACKET_FILL* pFill = (PACKET_FILL*)p;
+
+    // Check it's in the load region and fill it
+    if (pFill->address >= max_load_address || pFill->length > max_load_address - pFill->address)
+        err = -1;
+    else
+    {
+        memset((void*)(size_t)pFill->address, pFill->pattern, pFill->length);
+        cache_record(pFill->address, pFill->length);
+    }
+    next_address = pFill->address + pFill->length;
+
+    // Send ack
+    sendPacket(seq, PACKET_ID_ACK, &err, sizeof(err));
+
+    set_activity_led(0);
+}
+
+void handle_data_multi(uint32_t seq, const void* p, uint32_t cb)
+{
+    // Ignore if out of sequence
+    int err = 0;
+    if (!accept_stream_packet(seq, &err, sizeof(err)))
+        return;
+
+    // Flash activity led
+    set_activity_led(1);
+
+    // Apply each segment in order
+    const uint8_t* pData = (const uint8_t*)p;
+    const uint8_t* pEnd = pData + cb;
+    while (pData < pEnd)
+    {
+        // Check segment is complete
+        const DATA_SEGMENT* pSeg = (const DATA_SEGMENT*)pData;
+        if ((uint32_t)(pEnd - pData) < sizeof(DATA_SEGMENT) || 
+            pSeg->length > (uint32_t)(pEnd - pData) - sizeof(DATA_SEGMENT))
+        {
+            err = -2;
+            break;
+        }
+
+        // Check it's in the load region
+        if (pSeg->address >= max_load_address || pSeg->length > max_load_address - pSeg->address)
+        {
+            err = -1;
+            break;
+        }
+
+        // Copy it
+        memcpy((void*)(size_t)pSeg->address, pSeg->data, pSeg->length);
+        next_address = pSeg->address + pSeg->length;
+        cache_record(pSeg->address, pSeg->length);
+        pData += sizeof(DATA_SEGMENT) + pSeg->length;
+    }
 
     // Send ack
-    sendPacket(seq, PACKET_ID_ACK, NULL, 0);
+    sendPacket(seq, PACKET_ID_ACK, &err, sizeof(err));
 
     set_activity_led(0);
 }
@@ -0,0 +1,114 @@
+#include "common.h"
+
+// File CRC packet
+// host -> device - requests the CRC32 of the content of one or more files.
+// Packet data is a sequence of null terminated file names.
+
+// The result for each file
+typedef struct PACKED
+{
+    int err;
+    uint32_t crc;
+} FILE_CRC_RESULT;
+
+// File CRC ack packet
+// device -> host - the CRC32 of each requested file, in order
+typedef struct PACKED
+{
+    int err;
+    FILE_CRC_RESULT results[0];
+} PACKET_FILE_CRC_ACK;
+
+// Files are read in large chunks so FatFS can read directly from
+// the card with multi-block reads
+#define file_crc_buffer_size (1024 * 1024)
+static uint8_t* file_crc_buffer = NULL;
+
+// Calculate the CRC32 of a file
+static int file_crc(uint32_t seq, const char* filename, uint32_t* pcrc)
+{
+    // Allocate read buffer
+    if (file_crc_buffer == NULL)
+    {
+        file_crc_buffer = (uint8_t*)malloc_cache_aligned(file_crc_buffer_size);
+        if (file_crc_buffer == NULL)
+            return -3;
+    }
+
+    // Open file
+    FIL file;
+    int err = f_open(&file, filename, FA_READ | FA_OPEN_EXISTING);
+    if (err)
+        return err;
+
+    uint32_t crc;
+    crc32_start(&crc);
+    while (true)
+    {
+        // Read next chunk
+        UINT cbRead;
+        err = f_read(&file, file_crc_buffer, file_crc_buffer_size, &cbRead);
+        if (err || cbRead == 0)
+            break;
+
+        crc32_update(&crc, file_crc_buffer, cbRead);
+
+        // Send an empty stdout packet to stop the host timing out on large files
+        sendPacket(seq, PACKET_ID_STDOUT, NULL, 0);
+    }
+    crc32_finish(&crc);
+
+    f_close(&file);
+    *pcrc = crc;
+    return err;
+}
+
+void handle_file_crc(uint32_t seq, const void* p, uint32_t cb)
+{
+    PACKET_FILE_CRC_ACK* pAck = (PACKET_FILE_CRC_ACK*)response_buf;
+    pAck->err = 0;
+
+    // Make sure card mounted
+    int err = mount_sdcard();
+    if (err)
+    {
+        pAck->err = err;
+        sendPacket(seq, PACKET_ID_ACK, pAck, sizeof(PACKET_FILE_CRC_ACK));
+        return;
+    }
+
+    set_activity_led(1);
+
+    // Process each file name
+    const char* psz = (const char*)p;
+    const char* pszEnd = psz + cb;
+    uint32_t max_count = (max_packet_size - sizeof(PACKET_FILE_CRC_ACK)) / sizeof(FILE_CRC_RESULT);
+    uint32_t count = 0;
+    while (psz < pszEnd)
+    {
+        // Find the end of the name
+        const char* pszName = psz;
+        while (psz < pszEnd && *psz)
+            psz++;
+
+        // Check the name is terminated and the response will fit
+        if (psz == pszEnd || count == max_count)
+        {
+            pAck->err = -2;
+            count = 0;
+            break;
+        }
+        psz++;
+
+        // Calculate CRC
+        uint32_t crc = 0;
+        FILE_CRC_RESULT* pResult = &pAck->results[count++];
+        pResult->err = file_crc(seq, pszName, &crc);
+        pResult->crc = crc;
+    }
+
+    set_activity_led(0);
+
+    // Send ack
+    sendPacket(seq, PACKET_ID_ACK, pAck, sizeof(PACKET_FILE_CRC_ACK) + count * sizeof(FILE_CRC_RESULT));
+}
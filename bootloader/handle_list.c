@@ -0,0 +1,202 @@
+#include <ctype.h>
+#include "common.h"
+
+// List packet
+// host -> device - requests a directory listing
+typedef struct PACKED
+{
+    uint8_t flags;              // LIST_FLAG_xxx
+    char path[];                // Null terminated path to list, followed by a null
+                                // terminated glob pattern to filter names (may be empty)
+} PACKET_LIST;
+
+#define LIST_FLAG_RECURSIVE 0x01    // Also list the contents of matching sub-directories
+#define LIST_FLAG_SELF      0x02    // List the path itself, instead of its contents
+
+// List entry
+// device -> host - PACKET_ID_LIST_DATA packets contain one or more of these packed
+// back to back, followed by an ack with an error code when the listing is finished.
+typedef struct PACKED
+{
+    uint32_t size;              // The file's size
+    uint16_t time;              // In FatFS format
+    uint16_t date;              // In FatFS format
+    uint8_t attr;               // The file's attributes
+    char name[];                // Null terminated name, relative to the listed directory
+} LIST_ENTRY;
+
+// Listing state
+static uint32_t list_seq;
+static uint32_t list_used;
+
+// Case insensitive match of a name against a glob pattern with '*' and '?' wildcards
+static bool glob_match(const char* pattern, const char* name)
+{
+    while (*pattern)
+    {
+        if (*pattern == '*')
+        {
+            pattern++;
+            while (true)
+            {
+                if (glob_match(pattern, name))
+                    return true;
+                if (!*name)
+                    return false;
+                name++;
+            }
+        }
+
+        if (!*name)
+            return false;
+
+        if (*pattern != '?' && tolower(*pattern) != tolower(*name))
+            return false;
+
+        pattern++;
+        name++;
+    }
+    return *name == '\0';
+}
+
+// Send any buffered entries
+static void flush_list_entries()
+{
+    if (list_used)
+        sendPacket(list_seq, PACKET_ID_LIST_DATA, response_buf, list_used);
+    list_used = 0;
+}
+
+// Add an entry to the listing
+static int add_list_entry(const char* path, const char* name, const FILINFO* pfi)
+{
+    // Flush if won't fit
+    uint32_t cbEntry = sizeof(LIST_ENTRY) + strlen(name) + 1;
+    if (list_used + cbEntry > max_packet_size)
+        flush_list_entries();
+
+    // Add it
+    LIST_ENTRY* pEntry = (LIST_ENTRY*)(response_buf + list_used);
+    pEntry->size = pfi->fsize;
+    pEntry->time = pfi->ftime;
+    pEntry->date = pfi->fdate;
+    pEntry->attr = pfi->fattrib;
+    strcpy(pEntry->name, name);
+    list_used += cbEntry;
+    return 0;
+}
+
+// Enumerate the contents of a directory.  path and name are work buffers 
+// (FF_MAX_LFN) holding the directory's path and its name relative to the 
+// directory where enumeration started, and are restored on return.
+static int enum_directory_internal(char* path, char* name, const char* pattern, bool recursive, ENUM_ENTRY_CALLBACK callback)
+{
+    DIR dir;
+    int err = f_opendir(&dir, path);
+    if (err)
+        return err;
+
+    size_t pathLen = strlen(path);
+    size_t nameLen = strlen(name);
+
+    FILINFO fi;
+    while (true)
+    {
+        err = f_readdir(&dir, &fi);
+        if (err || fi.fname[0] == '\0')
+            break;
+
+        // Filter
+        if (pattern[0] && !glob_match(pattern, fi.fname))
+            continue;
+
+        // Check name will fit in work buffers
+        if (pathLen + strlen(fi.fname) + 2 > FF_MAX_LFN || nameLen + strlen(fi.fname) + 2 > FF_MAX_LFN)
+        {
+            err = FR_INVALID_NAME;
+            break;
+        }
+
+        // Work out full path and relative name
+        pathcat(path, fi.fname);
+        strcat(name, fi.fname);
+
+        // Process it
+        err = callback(path, name, &fi);
+
+        // Recurse into sub-directories (unfiltered)
+        if (!err && recursive && (fi.fattrib & AM_DIR))
+        {
+            strcat(name, "/");
+            err = enum_directory_internal(path, name, "", recursive, callback);
+        }
+
+        path[pathLen] = '\0';
+        name[nameLen] = '\0';
+        if (err)
+            break;
+    }
+
+    f_closedir(&dir);
+    return err;
+}
+
+// Enumerate the entries of a directory whose names match a glob pattern
+// (optional), and if recursive, the entire content of matching sub-directories.
+// Directories are enumerated before their content.
+int enum_directory(const char* path, const char* pattern, bool recursive, ENUM_ENTRY_CALLBACK callback)
+{
+    char szPath[FF_MAX_LFN];
+    char szName[FF_MAX_LFN];
+    if (strlen(path) >= FF_MAX_LFN)
+        return FR_INVALID_NAME;
+    strcpy(szPath, path);
+    szName[0] = '\0';
+    return enum_directory_internal(szPath, szName, pattern ? pattern : "", recursive, callback);
+}
+
+// Get the glob pattern that follows the path in a list packet (or any
+// packet with the same flags byte, path and pattern layout)
+const char* list_packet_pattern(const void* p, uint32_t cb)
+{
+    const PACKET_LIST* pList = (const PACKET_LIST*)p;
+    const char* pattern = pList->path + strlen(pList->path) + 1;
+    if ((uint32_t)(pattern - (const char*)p) >= cb)
+        return "";
+    return pattern;
+}
+
+static int handle_list_internal(uint32_t seq, const void* p, uint32_t cb)
+{
+    // Crack packet
+    const PACKET_LIST* pList = (const PACKET_LIST*)p;
+
+    // Make sure card mounted
+    int err = mount_sdcard();
+    if (err)
+        return err;
+
+    // Listing the path itself?
+    if (pList->flags & LIST_FLAG_SELF)
+    {
+        FILINFO fi;
+        err = f_stat_ex(pList->path, &fi);
+        if (err)
+            return err;
+        return add_list_entry(pList->path, fi.fname, &fi);
+    }
+
+    // List the directory
+    return enum_directory(pList->path, list_packet_pattern(p, cb), (pList->flags & LIST_FLAG_RECURSIVE) != 0, add_list_entry);
+}
+
+void handle_list(uint32_t seq, const void* p, uint32_t cb)
+{
+    list_seq = seq;
+    list_used = 0;
+
+    int err = handle_list_internal(seq, p, cb);
+    flush_list_entries();
+
+    sendPacket(seq, PACKET_ID_ACK, &err, sizeof(err));
+}
@@ -0,0 +1,105 @@
+#include "common.h"
+
+// Memory CRC packet
+// host -> device - requests the CRC32 of one or more regions of memory.
+// Packet data is an array of these ranges and the CRC is calculated over
+// the ranges in order.
+typedef struct PACKED
+{
+    uint32_t address;
+    uint32_t length;
+} MEMORY_RANGE;
+
+// Memory CRC ack packet
+// device -> host - the CRC32 of the requested memory ranges
+typedef struct PACKED
+{
+    int err;
+    uint32_t crc;
+} PACKET_MEMORY_CRC_ACK;
+
+void handle_memory_crc(uint32_t seq, const void* p, uint32_t cb)
+{
+    // Crack packet
+    const MEMORY_RANGE* pRanges = (const MEMORY_RANGE*)p;
+    uint32_t count = cb / sizeof(MEMORY_RANGE);
+    int err = 0;
+    uint32_t crc;
+    crc32_start(&crc);
+
+    // Check packet size
+    if (count == 0 || cb % sizeof(MEMORY_RANGE) != 0)
+        err = -2;
+
+    for (uint32_t i=0; i<count && err == 0; i++)
+    {
+        // Check it's in the load region
+        if (pRanges[i].address >= max_load_address || pRanges[i].length > max_load_address - pRanges[i].address)
+        {
+            err = -1;
+            break;
+        }
+
+        // Calculate CRC
+        crc32_update(&crc, (const void*)(size_t)pRanges[i].address, pRanges[i].length);
+    }
+    crc32_finish(&crc);
+
+    // Send ack
+    PACKET_MEMORY_CRC_ACK ack;
+    ack.err = err;
+    ack.crc = err == 0 ? crc : 0;
+    sendPacket(seq, PACKET_ID_ACK, &ack, sizeof(ack));
+}
+
+// Block CRC packet
+// host -> device - requests the CRC32 of each of a set of memory blocks.
+// Packet data is an array of MEMORY_RANGE, one per block.
+
+// Block CRC ack packet
+// device -> host - the CRC32 of each requested block
+typedef struct PACKED
+{
+    int err;
+    uint32_t crcs[0];
+} PACKET_BLOCK_CRC_ACK;
+
+void handle_block_crc(uint32_t seq, const void* p, uint32_t cb)
+{
+    // Crack packet
+    const MEMORY_RANGE* pRanges = (const MEMORY_RANGE*)p;
+    uint32_t count = cb / sizeof(MEMORY_RANGE);
+    PACKET_BLOCK_CRC_ACK* pAck = (PACKET_BLOCK_CRC_ACK*)response_buf;
+    pAck->err = 0;
+
+    // Check packet size and that the response will fit
+    if (count == 0 || cb % sizeof(MEMORY_RANGE) != 0 ||
+        count > (max_packet_size - sizeof(PACKET_BLOCK_CRC_ACK)) / sizeof(uint32_t))
+    {
+        pAck->err = -2;
+        count = 0;
+    }
+
+    // Check all blocks are in the load region
+    for (uint32_t i=0; i<count; i++)
+    {
+        if (pRanges[i].address >= max_load_address || pRanges[i].length > max_load_address - pRanges[i].address)
+        {
+            pAck->err = -1;
+            count = 0;
+        }
+    }
+
+    // Calculate CRCs
+    for (uint32_t i=0; i<count; i++)
+    {
+        pAck->crcs[i] = crc32((const void*)(size_t)pRanges[i].address, pRanges[i].length);
+
+        // Blocks queried for a delta upload are part of the image even
+        // if they're not resent, so include them in any cache entry
+        cache_record(pRanges[i].address, pRanges[i].length);
+    }
+
+    // Send ack
+    sendPacket(seq, PACKET_ID_ACK, pAck, sizeof(PACKET_BLOCK_CRC_ACK) + count * sizeof(uint32_t));
+}
@@ -23,7 +23,7 @@ typedef struct PACKED
     uint32_t aarch;              // Bootloader AARCH (32 or 64)
     uint32_t boardrev;           // Board revision
     uint64_t boardserial;        // Board serial number
-    uint32_t maxpacketsize;      // Maximum size of accepted packet
+    uint32_t maxpacketsize;      // Largest packet size that can be requested
     uint32_t cpu_freq;           // Current CPU freq
     uint32_t min_cpu_freq;       // Min CPU freq
     uint32_t max_cpu_freq;       // Max CPU freq
@@ -49,7 +49,7 @@ void handle_ping(uint32_t seq, const void* p, uint32_t cb)
     ack.aarch = AARCH;
     ack.boardrev = get_board_revision ();
     ack.boardserial = get_board_serial ();
-    ack.maxpacketsize = max_packet_size;
+    ack.maxpacketsize = max_packet_size_limit;
     ack.cpu_freq = get_cpu_freq();
     ack.min_cpu_freq = min_cpu_freq;
     ack.max_cpu_freq = max_cpu_freq;
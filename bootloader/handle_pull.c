@@ -21,47 +21,60 @@ typedef struct PACKED
 } PACKET_PULL_DATA;
 
 
-// Handler
-static int handle_pull_internal(uint32_t seq, const void* p, uint32_t cb)
+// Pull many packet
+// host -> device - requests the content of all files in a directory
+typedef struct PACKED
 {
-    // Make sure card mounted
-    int err = mount_sdcard();
-    if (err)
-        return err;
+    uint8_t flags;              // PULL_MANY_FLAG_xxx
+    char path[];                // Null terminated directory path, followed by a null
+                                // terminated glob pattern to filter names (may be empty)
+} PACKET_PULL_MANY;
 
-    const char* filename = (const char*)p;
+#define PULL_MANY_FLAG_RECURSIVE 0x01   // Also pull the content of matching sub-directories
 
-    // Stat file
-    FILINFO fi;
-    err = f_stat(filename, &fi);
-    if (err)
-        return err;
+// Sequence number of the pull request being processed
+static uint32_t pull_seq;
+
+// Read-ahead buffer.  Files are read in large chunks so FatFS reads
+// whole clusters with multi-block reads, and the data packets are sent
+// from the buffer.
+#define read_ahead_size (1024 * 1024)
+static uint8_t* read_ahead_buffer = NULL;
 
+// Send a file's header and content
+static int pull_file(uint32_t seq, const char* filename, const char* name, const FILINFO* pfi)
+{
     // Open file
     FIL file;
-    err = f_open(&file, filename, FA_READ);
+    int err = f_open(&file, filename, FA_READ);
     if (err)
         return err;
 
     // Send header
     PACKET_PULL_HEADER* pHeader = (PACKET_PULL_HEADER*)response_buf;
-    pHeader->size = fi.fsize;
-    pHeader->time = fi.ftime;
-    pHeader->date = fi.fdate;
-    pHeader->attr = fi.fattrib;
-    strcpy(pHeader->filename, fi.fname);
-    sendPacket(seq, PACKET_ID_PULL_HEADER, pHeader, sizeof(PACKET_PULL_HEADER) + strlen(fi.fname) + 1);
+    pHeader->size = pfi->fsize;
+    pHeader->time = pfi->ftime;
+    pHeader->date = pfi->fdate;
+    pHeader->attr = pfi->fattrib;
+    strcpy(pHeader->filename, name);
+    sendPacket(seq, PACKET_ID_PULL_HEADER, pHeader, sizeof(PACKET_PULL_HEADER) + strlen(name) + 1);
 
     PACKET_PULL_DATA* pData = (PACKET_PULL_DATA*)response_buf;
     pData->offset = 0;
+    uint32_t room = max_packet_size - sizeof(PACKET_PULL_DATA);
+
+    // Allocate read-ahead buffer (or read straight into the packet if can't)
+    if (read_ahead_buffer == NULL)
+        read_ahead_buffer = (uint8_t*)malloc_cache_aligned(read_ahead_size);
+    uint8_t* pBuf = read_ahead_buffer ? read_ahead_buffer : pData->data;
+    uint32_t cbBuf = read_ahead_buffer ? read_ahead_size : room;
 
     while (true)
     {
-        // Read next packet
-        uint32_t room = max_packet_size - sizeof(PACKET_PULL_DATA);
+        // Read next chunk
         UINT bytes_read;
         set_activity_led(1);
-        err = f_read(&file, pData->data, room, &bytes_read);
+        err = f_read(&file, pBuf, cbBuf, &bytes_read);
         set_activity_led(0);
         if (err)
         {
@@ -74,8 +87,14 @@ static int handle_pull_internal(uint32_t seq, const void* p, uint32_t cb)
             break;
 
         // Send it
-        sendPacket(seq, PACKET_ID_PULL_DATA, pData, sizeof(PACKET_PULL_DATA) + bytes_read);
-        pData->offset += bytes_read;
+        for (uint32_t pos = 0; pos < bytes_read; pos += room)
+        {
+            uint32_t cbPacket = bytes_read - pos < room ? bytes_read - pos : room;
+            if (pBuf != pData->data)
+                memcpy(pData->data, pBuf + pos, cbPacket);
+            sendPacket(seq, PACKET_ID_PULL_DATA, pData, sizeof(PACKET_PULL_DATA) + cbPacket);
+            pData->offset += cbPacket;
+        }
     }
 
     // Done!
@@ -83,9 +102,67 @@ static int handle_pull_internal(uint32_t seq, const void* p, uint32_t cb)
     return 0;
 }
 
+// Handler
+static int handle_pull_internal(uint32_t seq, const void* p, uint32_t cb)
+{
+    // Make sure card mounted
+    int err = mount_sdcard();
+    if (err)
+        return err;
+
+    const char* filename = (const char*)p;
+
+    // Stat file
+    FILINFO fi;
+    err = f_stat(filename, &fi);
+    if (err)
+        return err;
+
+    // Send it
+    return pull_file(seq, filename, fi.fname, &fi);
+}
+
 void handle_pull(uint32_t seq, const void* p, uint32_t cb)
 {
     int err = handle_pull_internal(seq, p, cb);
     sendPacket(seq, PACKET_ID_ACK, &err, sizeof(err));
 }
 
+// Send each file (or just the header for directories) found by pull many
+static int pull_many_entry(const char* path, const char* name, const FILINFO* pfi)
+{
+    if (pfi->fattrib & AM_DIR)
+    {
+        PACKET_PULL_HEADER* pHeader = (PACKET_PULL_HEADER*)response_buf;
+        pHeader->size = 0;
+        pHeader->time = pfi->ftime;
+        pHeader->date = pfi->fdate;
+        pHeader->attr = pfi->fattrib;
+        strcpy(pHeader->filename, name);
+        sendPacket(pull_seq, PACKET_ID_PULL_HEADER, pHeader, sizeof(PACKET_PULL_HEADER) + strlen(name) + 1);
+        return 0;
+    }
+
+    return pull_file(pull_seq, path, name, pfi);
+}
+
+static int handle_pull_many_internal(uint32_t seq, const void* p, uint32_t cb)
+{
+    // Crack packet
+    const PACKET_PULL_MANY* pPull = (const PACKET_PULL_MANY*)p;
+
+    // Make sure card mounted
+    int err = mount_sdcard();
+    if (err)
+        return err;
+
+    // Send everything
+    pull_seq = seq;
+    return enum_directory(pPull->path, list_packet_pattern(p, cb), (pPull->flags & PULL_MANY_FLAG_RECURSIVE) != 0, pull_many_entry);
+}
+
+void handle_pull_many(uint32_t seq, const void* p, uint32_t cb)
+{
+    int err = handle_pull_many_internal(seq, p, cb);
+    sendPacket(seq, PACKET_ID_ACK, &err, sizeof(err));
+}
@@ -24,12 +24,144 @@ typedef struct PACKED
     char     name[];            // Null terminated string with file name to push
 } PACKET_PUSH_COMMIT;
 
+// Header of each entry in a push archive stream, followed
+// by `size` bytes of file data (none for directories)
+typedef struct PACKED
+{
+    uint32_t size;              // File size
+    uint16_t time;              // In FatFS format
+    uint16_t date;              // In FatFS format
+    uint8_t  attr;              // The file's attributes (AM_DIR for directories)
+    uint8_t  overwrite;         // Whether to overwrite existing file (fail if exists)
+    char     name[];            // Null terminated string with file name to push
+} ARCHIVE_ENTRY;
+
 #define temp_filename "/sd/push.tmp"
 
 // File system state
 static uint32_t push_token = 0;
 static FIL file;
 
+// Sequence number and result of the last commit, so a commit resent
+// by the host (because the ack was lost) is acked again, not re-applied
+static uint32_t commit_seq = 0;
+static int commit_err = 0;
+
+// Archive stream state.  The stream is a sequence of ARCHIVE_ENTRYs
+// each followed by its file data, split into packets without regard to
+// entry boundaries.  Files are written directly to their final location.
+static uint32_t archive_token = 0;
+static uint32_t archive_offset = 0;         // Stream offset of next expected packet
+static int archive_err = 0;                 // Sticky error, reported for the rest of the stream
+static uint8_t archive_header[sizeof(ARCHIVE_ENTRY) + FF_MAX_LFN];
+static uint32_t archive_header_length = 0;  // Bytes of the current entry header received
+static uint32_t archive_remaining = 0;      // Bytes of file data still to come for current entry
+static bool archive_file_open = false;
+static char archive_dir[FF_MAX_LFN];        // Last directory known to exist
+
+// Write-behind buffer.  Pushed data is accumulated and written to the 
+// file in cluster sized chunks so FatFS can write whole sectors directly
+// to the card with multi-block writes, instead of a read-modify-write of
+// the partial sectors at each end of every packet.
+#define max_write_buffer_size (256 * 1024)
+static uint8_t* write_buffer = NULL;
+static uint32_t write_buffer_size = 0;      // Flush size for current file (0 if unbuffered)
+static uint32_t write_buffer_used = 0;
+
+// Time the current transfer started, so the `time` command can report it
+static uint64_t push_start_time = 0;
+
+// Reset the disk and serial timers at the start of a transfer
+static void push_timing_start()
+{
+    disk_read_time = 0;
+    disk_write_time = 0;
+    serial_write_time = 0;
+    sector_cache_hits = 0;
+    sector_cache_misses = 0;
+    push_start_time = micros();
+}
+
+// Update the times reported by the `time` command
+static void push_timing_update()
+{
+    last_disk_write_time = disk_write_time;
+    last_disk_read_time = disk_read_time;
+    last_serial_write_time = serial_write_time;
+    last_sector_cache_hits = sector_cache_hits;
+    last_sector_cache_misses = sector_cache_misses;
+    last_elapsed_time = micros() - push_start_time;
+}
+
+// Setup the write-behind buffer for a newly opened file
+static void write_buffer_open()
+{
+    // Allocate buffer
+    if (write_buffer == NULL)
+        write_buffer = (uint8_t*)malloc_cache_aligned(max_write_buffer_size);
+
+    // Flush a cluster at a time (starting from file offset 0 
+    // means every flush is cluster aligned)
+    write_buffer_used = 0;
+    write_buffer_size = write_buffer ? file.obj.fs->csize * FF_MAX_SS : 0;
+    if (write_buffer_size > max_write_buffer_size)
+        write_buffer_size = max_write_buffer_size;
+}
+
+// Write buffered data to the file
+static int write_buffer_flush()
+{
+    if (write_buffer_used == 0)
+        return 0;
+
+    UINT cbWritten;
+    uint32_t cbBuffered = write_buffer_used;
+    write_buffer_used = 0;
+    int err = f_write(&file, write_buffer, cbBuffered, &cbWritten);
+    if (err)
+        return err;
+    if (cbWritten != cbBuffered)
+        return -3;
+    return 0;
+}
+
+// Write data to the file through the write-behind buffer
+static int write_buffered(const void* p, uint32_t cb)
+{
+    // Unbuffered?
+    if (write_buffer_size == 0)
+    {
+        UINT cbWritten;
+        int err = f_write(&file, p, cb, &cbWritten);
+        if (err)
+            return err;
+        if (cbWritten != cb)
+            return -3;
+        return 0;
+    }
+
+    while (cb)
+    {
+        // Copy to buffer
+        uint32_t cbChunk = write_buffer_size - write_buffer_used;
+        if (cbChunk > cb)
+            cbChunk = cb;
+        memcpy(write_buffer + write_buffer_used, p, cbChunk);
+        write_buffer_used += cbChunk;
+        p = (const uint8_t*)p + cbChunk;
+        cb -= cbChunk;
+
+        // Flush when full
+        if (write_buffer_used == write_buffer_size)
+        {
+            int err = write_buffer_flush();
+            if (err)
+                return err;
+        }
+    }
+    return 0;
+}
+
 // Handler
 static int handle_push_data_internal(uint32_t seq, const void* p, uint32_t cb)
 {
@@ -46,11 +178,14 @@ static int handle_push_data_internal(uint32_t seq, const void* p, uint32_t cb)
     {
         // Close old file
         reset_push();
+        commit_seq = 0;
+        push_timing_start();
 
         // Open the file
         err = f_open(&file, temp_filename, FA_WRITE|FA_CREATE_ALWAYS);
         if (err)
             return err;
+        write_buffer_open();
 
         // Store token
         push_token = pPush->token;
@@ -62,21 +197,12 @@ static int handle_push_data_internal(uint32_t seq, const void* p, uint32_t cb)
             return -1;
 
         // Check offset matches
-        if (pPush->offset != f_tell(&file))
+        if (pPush->offset != f_tell(&file) + write_buffer_used)
             return -2;
     }
 
     // Write packet
-    UINT cbWritten;
-    err = f_write(&file, pPush->data, cb - sizeof(PACKET_PUSH_DATA), &cbWritten);
-    if (err)
-        return err;
-
-    // Sanity check
-    if (cbWritten != cb - sizeof(PACKET_PUSH_DATA))
-        return -3;
-
-    return 0;
+    return write_buffered(pPush->data, cb - sizeof(PACKET_PUSH_DATA));
 }
 
 static int handle_push_commit_internal(uint32_t seq, const void* p, uint32_t cb)
@@ -89,14 +215,20 @@ static int handle_push_commit_internal(uint32_t seq, const void* p, uint32_t cb)
         return -1;
 
     // Check size matches
-    if (pPush->size != f_tell(&file))
+    if (pPush->size != f_tell(&file) + write_buffer_used)
         return -2;
 
-    // Close temp file
-    int err = f_close(&file);
+    // Write buffered data and close temp file
+    int err = write_buffer_flush();
+    int errClose = f_close(&file);
     push_token = 0;
+    if (err == 0)
+        err = errClose;
     if (err)
+    {
+        f_unlink(temp_filename);
         return err;
+    }
 
     // Set file times
     FILINFO fi;
@@ -127,22 +259,233 @@ static int handle_push_commit_internal(uint32_t seq, const void* p, uint32_t cb)
         return err;
     }
 
+    push_timing_update();
+
     // Send ok response
     return 0;
 }
 
+// Close the file currently being unpacked from an archive, deleting
+// it if it's incomplete
+static void archive_close_file(bool discard)
+{
+    if (archive_file_open)
+    {
+        write_buffer_used = 0;
+        f_close(&file);
+        archive_file_open = false;
+        if (discard)
+            f_unlink(((const ARCHIVE_ENTRY*)archive_header)->name);
+    }
+}
+
+// Finish the current archive entry
+static int archive_end_entry()
+{
+    const ARCHIVE_ENTRY* pEntry = (const ARCHIVE_ENTRY*)archive_header;
+
+    // Write buffered data and close the file
+    int err = write_buffer_flush();
+    int errClose = f_close(&file);
+    archive_file_open = false;
+    if (err == 0)
+        err = errClose;
+    if (err)
+    {
+        f_unlink(pEntry->name);
+        return err;
+    }
+
+    // Set file times
+    FILINFO fi;
+    fi.fdate = pEntry->date;
+    fi.ftime = pEntry->time;
+    return f_utime(pEntry->name, &fi);
+}
+
+// Start a new archive entry once its header has been received
+static int archive_begin_entry()
+{
+    const ARCHIVE_ENTRY* pEntry = (const ARCHIVE_ENTRY*)archive_header;
+
+    // Directory?
+    if (pEntry->attr & AM_DIR)
+    {
+        archive_remaining = 0;
+        int err = f_mkdir_r(pEntry->name);
+        if (err && err != FR_EXIST)
+            return err;
+        strcpy(archive_dir, pEntry->name);
+        pathcan(archive_dir);
+        return 0;
+    }
+
+    // Make sure the target directory exists (usually the same as
+    // the previous entry so skip the file system lookups)
+    char szDir[FF_MAX_LFN];
+    pathdir(pEntry->name, szDir);
+    pathcan(szDir);
+    if (strcmp(szDir, archive_dir) != 0)
+    {
+        f_mkdir_r(szDir);
+        strcpy(archive_dir, szDir);
+    }
+
+    // Create the file
+    int err = f_open(&file, pEntry->name, FA_WRITE | (pEntry->overwrite ? FA_CREATE_ALWAYS : FA_CREATE_NEW));
+    if (err)
+        return err;
+    archive_file_open = true;
+    write_buffer_open();
+
+    // Empty file?
+    archive_remaining = pEntry->size;
+    if (archive_remaining == 0)
+        return archive_end_entry();
+
+    return 0;
+}
+
+// Unpack a block of the archive stream
+static int archive_unpack(const uint8_t* p, uint32_t cb)
+{
+    while (cb)
+    {
+        // Receiving file data?
+        if (archive_remaining)
+        {
+            // Write as much as belongs to this file
+            uint32_t cbChunk = cb < archive_remaining ? cb : archive_remaining;
+            int err = write_buffered(p, cbChunk);
+            if (err)
+                return err;
+            p += cbChunk;
+            cb -= cbChunk;
+
+            // End of file?
+            archive_remaining -= cbChunk;
+            if (archive_remaining == 0)
+            {
+                err = archive_end_entry();
+                if (err)
+                    return err;
+            }
+            continue;
+        }
+
+        // Accumulate entry header up to and including the name terminator
+        uint8_t b = *p++;
+        cb--;
+        if (archive_header_length >= sizeof(archive_header))
+            return -4;
+        archive_header[archive_header_length++] = b;
+        if (archive_header_length > sizeof(ARCHIVE_ENTRY) && b == 0)
+        {
+            archive_header_length = 0;
+            int err = archive_begin_entry();
+            if (err)
+                return err;
+        }
+    }
+
+    return 0;
+}
+
+static int handle_push_archive_internal(uint32_t seq, const void* p, uint32_t cb)
+{
+    // Crack packet
+    const PACKET_PUSH_DATA* pPush = (const PACKET_PUSH_DATA*)p;
+
+    // Make sure card mounted
+    int err = mount_sdcard();
+    if (err)
+        return err;
+
+    // New or continued stream?
+    if (pPush->offset == 0)
+    {
+        // Close anything previously in progress
+        reset_push();
+        commit_seq = 0;
+        push_timing_start();
+
+        // Start new stream
+        archive_token = pPush->token;
+        archive_offset = 0;
+        archive_err = 0;
+        archive_header_length = 0;
+        archive_remaining = 0;
+        archive_dir[0] = '\0';
+    }
+    else
+    {
+        // Check token matches
+        if (pPush->token != archive_token)
+            return -1;
+
+        // Report earlier failure
+        if (archive_err)
+            return archive_err;
+
+        // Check offset matches
+        if (pPush->offset != archive_offset)
+            return -2;
+    }
+
+    // Unpack it
+    uint32_t cbData = cb - sizeof(PACKET_PUSH_DATA);
+    archive_offset += cbData;
+    err = archive_unpack(pPush->data, cbData);
+    if (err)
+    {
+        // Don't leave partial files behind
+        archive_close_file(true);
+        archive_err = err;
+    }
+
+    push_timing_update();
+    return err;
+}
+
 void handle_push_data(uint32_t seq, const void* p, uint32_t cb)
 {
+    // Ignore if out of sequence
+    int ok = 0;
+    if (!accept_stream_packet(seq, &ok, sizeof(ok)))
+        return;
+
     set_activity_led(1);
     int err = handle_push_data_internal(seq, p, cb);
     sendPacket(seq, PACKET_ID_ACK, &err, sizeof(err));
     set_activity_led(0);
 }
 
+void handle_push_archive(uint32_t seq, const void* p, uint32_t cb)
+{
+    // Ignore if out of sequence
+    int ok = 0;
+    if (!accept_stream_packet(seq, &ok, sizeof(ok)))
+        return;
+
+    set_activity_led(1);
+    int err = handle_push_archive_internal(seq, p, cb);
+    sendPacket(seq, PACKET_ID_ACK, &err, sizeof(err));
+    set_activity_led(0);
+}
+
 void handle_push_commit(uint32_t seq, const void* p, uint32_t cb)
 {
+    // Resent commit?
+    if (commit_seq != 0 && seq == commit_seq)
+    {
+        sendPacket(seq, PACKET_ID_ACK, &commit_err, sizeof(commit_err));
+        return;
+    }
+
     set_activity_led(1);
     int err = handle_push_commit_internal(seq, p, cb);
+    commit_seq = seq;
+    commit_err = err;
     sendPacket(seq, PACKET_ID_ACK, &err, sizeof(err));
     set_activity_led(0);
 }
@@ -151,8 +494,16 @@ void reset_push()
 {
     if (push_token != 0)
     {
+        write_buffer_used = 0;
         f_close(&file);
         f_unlink(temp_filename);
         push_token = 0;
     }
+
+    // Abandon archive stream
+    if (archive_token != 0)
+    {
+        archive_close_file(true);
+        archive_token = 0;
+    }
 }
@@ -0,0 +1,80 @@
+#include <string.h>
+
+#include "lz4.h"
+
+// Read an LZ4 extended length (sequence of bytes added while 255)
+static int read_length(const uint8_t** pp, const uint8_t* pEnd, uint32_t* plength)
+{
+    uint8_t b;
+    do
+    {
+        if (*pp >= pEnd)
+            return -1;
+        b = *(*pp)++;
+        *plength += b;
+    } while (b == 255);
+    return 0;
+}
+
+// Decompress a block of LZ4 data
+// Matches can only refer to data previously decompressed in the same block
+int lz4_decompress(const void* pSrc, uint32_t cbSrc, void* pDst, uint32_t cbDst)
+{
+    const uint8_t* p = (const uint8_t*)pSrc;
+    const uint8_t* pEnd = p + cbSrc;
+    uint8_t* pOut = (uint8_t*)pDst;
+    uint8_t* pOutEnd = pOut + cbDst;
+
+    while (p < pEnd)
+    {
+        // Read token
+        uint8_t token = *p++;
+
+        // Literal length
+        uint32_t literal_length = token >> 4;
+        if (literal_length == 15 && read_length(&p, pEnd, &literal_length))
+            return -1;
+
+        // Copy literals
+        if (literal_length > (uint32_t)(pEnd - p) || literal_length > (uint32_t)(pOutEnd - pOut))
+            return -1;
+        memcpy(pOut, p, literal_length);
+        pOut += literal_length;
+        p += literal_length;
+
+        // Last sequence has no match
+        if (p == pEnd)
+            break;
+
+        // Match offset
+        if (pEnd - p < 2)
+            return -1;
+        uint32_t offset = p[0] | (p[1] << 8);
+        p += 2;
+        if (offset == 0 || offset > (uint32_t)(pOut - (uint8_t*)pDst))
+            return -1;
+
+        // Match length
+        uint32_t match_length = token & 0x0F;
+        if (match_length == 15 && read_length(&p, pEnd, &match_length))
+            return -1;
+        match_length += 4;
+        if (match_length > (uint32_t)(pOutEnd - pOut))
+            return -1;
+
+        // Copy match (byte by byte as it may overlap, eg: runs)
+        const uint8_t* pMatch = pOut - offset;
+        if (offset >= match_length)
+        {
+            memcpy(pOut, pMatch, match_length);
+            pOut += match_length;
+        }
+        else
+        {
+            while (match_length--)
+                *pOut++ = *pMatch++;
+        }
+    }
+
+    return pOut - (uint8_t*)pDst;
+}
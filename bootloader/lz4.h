@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Decompress a block of LZ4 compressed data (raw block format, no frame)
+// Returns the number of bytes written to pDst, or -1 if the compressed
+// data is invalid or would overflow cbDst.
+int lz4_decompress(const void* pSrc, uint32_t cbSrc, void* pDst, uint32_t cbDst);
+
+#ifdef __cplusplus
+}
+#endif
@@ -5,9 +5,11 @@
 // The default baud rate
 #define default_baud 115200
 
-// Packet decoder buffer
-uint8_t decoder_buf[max_packet_size];
-uint8_t response_buf[max_packet_size];
+// Packet decoder and buffers (allocated by set_max_packet_size)
+static decode_context decoder = {0};
+static uint8_t* decoder_buf = NULL;
+uint8_t* response_buf = NULL;
+uint32_t max_packet_size = 0;
 
 // Currently selected baud rate
 unsigned current_baud = default_baud;
@@ -29,12 +31,16 @@ uint64_t serial_write_time = 0;
 // Set when autochain is pending
 bool autochain_armed = false;
 
-// Error report packet
+// Sequence number of the last packet received in order
+uint32_t last_seq = 0;
+
+// Negative acknowledge packet
 // device -> host sent on packet decode error
 typedef struct PACKED
 {
-    int code;
-} PACKET_ERROR;
+    int code;                   // The decoder error code
+    uint32_t expected_seq;      // The sequence number the device expected
+} PACKET_NAK;
 
 
 void restore_cpu_freq()
@@ -46,27 +52,110 @@ void restore_cpu_freq()
     }
 }
 
-// Helper to send a single byte (correct signature for packet encoder callback)
-void send_byte(uint8_t byte)
+// Helper to send encoded bytes (correct signature for packet encoder callback)
+void send_bytes(const void* pData, uint32_t cbData)
 {
-    uart_send(byte);
+    uart_send_buf(pData, cbData);
 }
 
 // Send a packet to the host
 void sendPacket(uint32_t seq, uint32_t id, const void* pData, uint32_t cbData)
 {
     uint64_t start = micros();
-    packet_encode(send_byte, seq, id, pData, cbData);
+    packet_encode_buf(send_bytes, seq, id, pData, cbData);
     serial_write_time += micros() - start;
 }
 
 
+// Allocate the decoder and response buffers for a maximum packet size.
+// If the buffers can't be allocated the current size is kept (check
+// max_packet_size afterwards).
+// Note: this frees the decoder buffer so packet handlers must not access
+// their packet after calling this.
+void set_max_packet_size(uint32_t size)
+{
+    // Clamp
+    if (size < default_packet_size)
+        size = default_packet_size;
+    if (size > max_packet_size_limit)
+        size = max_packet_size_limit;
+
+    // Redundant?
+    if (size == max_packet_size)
+        return;
+
+    // Allocate new buffers before releasing the old ones so the current
+    // size stays in effect (and is reported back) if allocation fails
+    uint8_t* new_decoder_buf = (uint8_t*)malloc(size);
+    uint8_t* new_response_buf = (uint8_t*)malloc(size);
+    if (new_decoder_buf == NULL || new_response_buf == NULL)
+    {
+        if (new_decoder_buf)
+            free(new_decoder_buf);
+        if (new_response_buf)
+            free(new_response_buf);
+        return;
+    }
+
+    // Switch to them
+    if (decoder_buf)
+        free(decoder_buf);
+    if (response_buf)
+        free(response_buf);
+    decoder_buf = new_decoder_buf;
+    response_buf = new_response_buf;
+    max_packet_size = size;
+
+    // Update decoder
+    decoder.pBuf = decoder_buf;
+    decoder.cbBuf = size;
+}
+
+// Data and push packets can be pipelined by the host (ie: sent without
+// waiting for the previous packet's ack).  They're only applied if they're
+// the next packet in sequence.  Otherwise (duplicate, or a gap because an
+// earlier packet was lost) the last in-order packet is acked again as a
+// cumulative ack and the host resends from the first gap.
+bool accept_stream_packet(uint32_t seq, const void* pAck, uint32_t cbAck)
+{
+    // Next in sequence?
+    if (seq == last_seq + 1)
+    {
+        last_seq = seq;
+        return true;
+    }
+
+    // Re-ack the last in-order packet
+    sendPacket(last_seq, PACKET_ID_ACK, pAck, cbAck);
+    return false;
+}
+
+// Check if a packet is part of a pipelined stream
+static bool is_stream_packet(uint32_t id)
+{
+    switch (id)
+    {
+        case PACKET_ID_DATA:
+        case PACKET_ID_DATA_COMPRESSED:
+        case PACKET_ID_FILL:
+        case PACKET_ID_DATA_MULTI:
+        case PACKET_ID_PUSH_DATA:
+        case PACKET_ID_PUSH_ARCHIVE:
+            return true;
+    }
+    return false;
+}
+
 // Receive a packet from the host
 void onPacketReceived(uint32_t seq, uint32_t id, const void* p, uint32_t cb)
 {
     // Disarm autochain once a packet is received
     autochain_armed = false;
 
+    // All other packets are sent one at a time and (re)start the sequence
+    if (!is_stream_packet(id))
+        last_seq = seq;
+
     // Dispatch by id
     switch (id)
     {
@@ -78,6 +167,42 @@ void onPacketReceived(uint32_t seq, uint32_t id, const void* p, uint32_t cb)
             handle_data(seq, p, cb);
             break;
 
+        case PACKET_ID_DATA_COMPRESSED:
+            handle_data_compressed(seq, p, cb);
+            break;
+
+        case PACKET_ID_FILL:
+            handle_fill(seq, p, cb);
+            break;
+
+        case PACKET_ID_DATA_MULTI:
+            handle_data_multi(seq, p, cb);
+            break;
+
+        case PACKET_ID_MEMORY_CRC:
+            handle_memory_crc(seq, p, cb);
+            break;
+
+        case PACKET_ID_BLOCK_CRC:
+            handle_block_crc(seq, p, cb);
+            break;
+
+        case PACKET_ID_CACHE_LOAD:
+            handle_cache_load(seq, p, cb);
+            break;
+
+        case PACKET_ID_CACHE_STORE:
+            handle_cache_store(seq, p, cb);
+            break;
+
+        case PACKET_ID_LIST:
+            handle_list(seq, p, cb);
+            break;
+
+        case PACKET_ID_PULL_MANY:
+            handle_pull_many(seq, p, cb);
+            break;
+
         case PACKET_ID_GO:
             handle_go(seq, p, cb);
             break;
@@ -99,6 +224,14 @@ void onPacketReceived(uint32_t seq, uint32_t id, const void* p, uint32_t cb)
             handle_push_commit(seq, p, cb);
             break;
 
+        case PACKET_ID_PUSH_ARCHIVE:
+            handle_push_archive(seq, p, cb);
+            break;
+
+        case PACKET_ID_FILE_CRC:
+            handle_file_crc(seq, p, cb);
+            break;
+
         case PACKET_ID_COMMAND:
             handle_command(seq, p, cb);
             break;
@@ -110,12 +243,14 @@ void onPacketReceived(uint32_t seq, uint32_t id, const void* p, uint32_t cb)
 
 
 // Callback to handle packet decode errors
-// Just pass to host for informational/debugging purposes
+// Tell the host which packet we were expecting so it can retransmit
+// immediately rather than waiting for the ack timeout
 void onPacketError(int code)
 {
-    PACKET_ERROR err;
-    err.code = code;
-    sendPacket(0, PACKET_ID_ERROR, &err, sizeof(err));
+    PACKET_NAK nak;
+    nak.code = code;
+    nak.expected_seq = last_seq + 1;
+    sendPacket(0, PACKET_ID_NAK, &nak, sizeof(nak));
 }
 
 
@@ -124,6 +259,7 @@ int main()
 {
     // Initialize hardware
     timer_init();
+    crc32_init();
     uart_init(current_baud);
     min_cpu_freq = get_min_cpu_freq();
     max_cpu_freq = get_max_cpu_freq();
@@ -131,11 +267,11 @@ int main()
     process_cmdline();
 
     // Setup packet decoder
-    decode_context ctx = {0};
-    ctx.onError = onPacketError;
-    ctx.onPacket = onPacketReceived;
-    ctx.pBuf = decoder_buf;
-    ctx.cbBuf = sizeof(decoder_buf);
+    decoder.onError = onPacketError;
+    decoder.onPacket = onPacketReceived;
+    decoder.onRedirect = redirect_data;
+    decoder.cbRedirectHeader = 8;       // DATA packet address and length
+    set_max_packet_size(default_packet_size);
 
     // Setup activity pattern
     autochain_armed = cl_autochain_target != NULL && cl_autochain_timeout_millis != 0;
@@ -147,9 +283,10 @@ int main()
     while (true)
     {
         // Read serial bytes
-        int recv_byte;
-        while ((recv_byte = uart_try_recv()) >= 0)
-            packet_decode(&ctx, recv_byte);
+        uint8_t recv_buf[256];
+        uint32_t recv_count;
+        while ((recv_count = uart_try_recv_buf(recv_buf, sizeof(recv_buf))) > 0)
+            packet_decode_buf(&decoder, recv_buf, recv_count);
 
         uint32_t tick_ms = millis();
 
@@ -167,6 +304,10 @@ int main()
             // Reset CPU freq
             restore_cpu_freq();
 
+            // Reset packet size
+            set_max_packet_size(default_packet_size);
+            uart_set_rx_buffer_size(UART_RX_BUFFER_SIZE);
+
             // Reset other operations
             reset_push();
         }
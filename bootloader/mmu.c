@@ -0,0 +1,223 @@
+#include "raspi.h"
+#include "mmu.h"
+
+// Identity mapped translation tables.  Everything below the peripheral
+// base (PBASE) is mapped as normal write-back cacheable memory, everything
+// above as device memory.  Tables are built once at startup and never
+// change.  The MMU is turned off again by BRANCHTO (see vectors.S) before
+// starting a loaded program.
+
+// SCTLR/HSCTLR/SCTLR_ELx flags
+#define SCTLR_M             (1 << 0)        // MMU enable
+#define SCTLR_C             (1 << 2)        // Data cache enable
+#define SCTLR_Z             (1 << 11)       // Branch prediction enable (aarch32)
+#define SCTLR_I             (1 << 12)       // Instruction cache enable
+#define SCTLR_XP            (1 << 23)       // ARMv6 page table format (ARM1176)
+
+#if RASPI == 1
+
+// ARM1176 short descriptor 1MB sections (ARM1176JZF-S TRM, section 6.11)
+#define SECTION             0x2
+#define SECTION_B           (1 << 2)
+#define SECTION_C           (1 << 3)
+#define SECTION_XN          (1 << 4)
+#define SECTION_AP_RW       (3 << 10)
+#define SECTION_TEX(x)      ((x) << 12)
+
+// Normal: outer and inner write-back, write-allocate
+// Device: strongly ordered, never executable
+#define SECTION_NORMAL      (SECTION | SECTION_AP_RW | SECTION_TEX(1) | SECTION_C | SECTION_B)
+#define SECTION_DEVICE      (SECTION | SECTION_AP_RW | SECTION_XN)
+
+static uint32_t section_table[4096] __attribute__((aligned(16384)));
+
+void mmu_init()
+{
+    // Build the table
+    for (uint32_t i=0; i<4096; i++)
+    {
+        uint32_t addr = i << 20;
+        section_table[i] = addr | (addr < PBASE ? SECTION_NORMAL : SECTION_DEVICE);
+    }
+
+    // Invalidate caches and TLBs
+    __asm__ __volatile__ (
+        "mcr p15, 0, %0, c7, c7, 0\n"       // Invalidate instruction and data caches
+        "mcr p15, 0, %0, c8, c7, 0\n"       // Invalidate TLBs
+        "mcr p15, 0, %0, c7, c10, 4\n"      // DSB
+        :: "r" (0) : "memory");
+
+    // Only use TTBR0, domain 0 as client (access permissions checked)
+    __asm__ __volatile__ ("mcr p15, 0, %0, c2, c0, 2" :: "r" (0));
+    __asm__ __volatile__ ("mcr p15, 0, %0, c2, c0, 0" :: "r" (section_table) : "memory");
+    __asm__ __volatile__ ("mcr p15, 0, %0, c3, c0, 0" :: "r" (1));
+
+    // Enable MMU and caches
+    uint32_t sctlr;
+    __asm__ __volatile__ ("mrc p15, 0, %0, c1, c0, 0" : "=r" (sctlr));
+    sctlr |= SCTLR_M | SCTLR_C | SCTLR_Z | SCTLR_I | SCTLR_XP;
+    __asm__ __volatile__ (
+        "mcr p15, 0, %0, c1, c0, 0\n"
+        "mcr p15, 0, %1, c7, c5, 4\n"       // Prefetch flush
+        :: "r" (sctlr), "r" (0) : "memory");
+}
+
+#else
+
+// Long descriptor format (ARMv7-A LPAE and ARMv8-A, 4KB granule). Level 1
+// entries map 1GB blocks, the 1GB containing PBASE is split into 2MB
+// blocks by a level 2 table.
+#define DESC_BLOCK          0x1
+#define DESC_TABLE          0x3
+#define DESC_ATTR_INDEX(x)  ((x) << 2)
+#define DESC_AP1            (1 << 6)        // RES1 at EL2/Hyp (AP[2:1]=0 is read/write)
+#define DESC_SH_INNER       (3 << 8)
+#define DESC_AF             (1 << 10)
+#define DESC_PXN            (1ULL << 53)    // RES0 at EL2/Hyp
+#define DESC_XN             (1ULL << 54)
+
+// MAIR attribute 0 is normal memory, inner and outer write-back
+// read/write allocate. Attribute 1 is Device-nGnRnE (strongly ordered)
+#define MAIR_VALUE          0x00FF
+#define ATTR_NORMAL         0
+#define ATTR_DEVICE         1
+
+// TCR/TTBCR/HTCR: table walks are inner shareable and write-back cacheable
+#define TCR_WALK_CACHEABLE  ((1 << 8) | (1 << 10) | (3 << 12))
+
+static uint64_t level1_table[4] __attribute__((aligned(4096)));
+static uint64_t level2_table[512] __attribute__((aligned(4096)));
+
+// Build the tables for a 4GB identity map. Some descriptor bits differ
+// between the EL2/Hyp and EL1/SVC translation regimes.
+static void build_tables(bool el2)
+{
+    uint64_t common = DESC_BLOCK | DESC_AF | (el2 ? DESC_AP1 : 0);
+    uint64_t normal = common | DESC_ATTR_INDEX(ATTR_NORMAL) | DESC_SH_INNER;
+    uint64_t device = common | DESC_ATTR_INDEX(ATTR_DEVICE) | (el2 ? DESC_XN : (DESC_XN | DESC_PXN));
+
+    for (int i=0; i<4; i++)
+    {
+        uint64_t addr = (uint64_t)i << 30;
+        if (addr + (1 << 30) <= PBASE)
+            level1_table[i] = addr | normal;
+        else if (addr >= PBASE)
+            level1_table[i] = addr | device;
+        else
+        {
+            for (int j=0; j<512; j++)
+            {
+                uint64_t block = addr + ((uint64_t)j << 21);
+                level2_table[j] = block | (block < PBASE ? normal : device);
+            }
+            level1_table[i] = (uint64_t)(size_t)level2_table | DESC_TABLE;
+        }
+    }
+}
+
+#if AARCH == 64
+
+void mmu_init()
+{
+    uint64_t el;
+    __asm__ __volatile__ ("mrs %0, CurrentEL" : "=r" (el));
+    el = (el >> 2) & 3;
+
+    build_tables(el == 2);
+
+    // Caches should already be empty but make sure
+    cache_clean_invalidate_all();
+    __asm__ __volatile__ ("ic iallu" ::: "memory");
+
+    // 32-bit address space, 4KB granule, TTBR0 only
+    uint64_t sctlr;
+    if (el == 2)
+    {
+        uint64_t tcr = 32 | TCR_WALK_CACHEABLE | (1 << 23) | (1U << 31);
+        __asm__ __volatile__ (
+            "msr mair_el2, %0\n"
+            "msr tcr_el2, %1\n"
+            "msr ttbr0_el2, %2\n"
+            "isb\n"
+            "tlbi alle2\n"
+            "dsb sy\n"
+            "isb\n"
+            : : "r" ((uint64_t)MAIR_VALUE), "r" (tcr), "r" (level1_table) : "memory");
+        __asm__ __volatile__ ("mrs %0, sctlr_el2" : "=r" (sctlr));
+        sctlr |= SCTLR_M | SCTLR_C | SCTLR_I;
+        __asm__ __volatile__ ("msr sctlr_el2, %0\n isb" :: "r" (sctlr) : "memory");
+    }
+    else
+    {
+        uint64_t tcr = 32 | TCR_WALK_CACHEABLE | (1 << 23);     // EPD1, no TTBR1 walks
+        __asm__ __volatile__ (
+            "msr mair_el1, %0\n"
+            "msr tcr_el1, %1\n"
+            "msr ttbr0_el1, %2\n"
+            "isb\n"
+            "tlbi vmalle1\n"
+            "dsb sy\n"
+            "isb\n"
+            : : "r" ((uint64_t)MAIR_VALUE), "r" (tcr), "r" (level1_table) : "memory");
+        __asm__ __volatile__ ("mrs %0, sctlr_el1" : "=r" (sctlr));
+        sctlr |= SCTLR_M | SCTLR_C | SCTLR_I;
+        __asm__ __volatile__ ("msr sctlr_el1, %0\n isb" :: "r" (sctlr) : "memory");
+    }
+}
+
+#else
+
+void mmu_init()
+{
+    // The firmware starts the Pi 2 and later in Hyp mode which has its
+    // own translation regime (long descriptors only)
+    uint32_t cpsr;
+    __asm__ __volatile__ ("mrs %0, cpsr" : "=r" (cpsr));
+    bool hyp = (cpsr & 0x1F) == 0x1A;
+
+    build_tables(hyp);
+
+    // Caches should already be empty but make sure
+    cache_clean_invalidate_all();
+    __asm__ __volatile__ ("mcr p15, 0, %0, c7, c5, 0" :: "r" (0) : "memory");
+
+    // 32-bit address space, TTBR0 only
+    uint64_t ttbr = (uint64_t)(size_t)level1_table;
+    uint32_t sctlr;
+    if (hyp)
+    {
+        uint32_t htcr = TCR_WALK_CACHEABLE | (1 << 23) | (1U << 31);
+        __asm__ __volatile__ (
+            "mcr p15, 4, %0, c10, c2, 0\n"      // HMAIR0
+            "mcr p15, 4, %1, c2, c0, 2\n"       // HTCR
+            "mcrr p15, 4, %Q2, %R2, c2\n"       // HTTBR
+            "isb\n"
+            "mcr p15, 4, %3, c8, c7, 0\n"       // TLBIALLH
+            "dsb\n"
+            "isb\n"
+            :: "r" (MAIR_VALUE), "r" (htcr), "r" (ttbr), "r" (0) : "memory");
+        __asm__ __volatile__ ("mrc p15, 4, %0, c1, c0, 0" : "=r" (sctlr));
+        sctlr |= SCTLR_M | SCTLR_C | SCTLR_I;
+        __asm__ __volatile__ ("mcr p15, 4, %0, c1, c0, 0\n isb" :: "r" (sctlr) : "memory");
+    }
+    else
+    {
+        uint32_t ttbcr = TCR_WALK_CACHEABLE | (1 << 23) | (1U << 31);   // EAE, EPD1
+        __asm__ __volatile__ (
+            "mcr p15, 0, %0, c10, c2, 0\n"      // MAIR0
+            "mcr p15, 0, %1, c2, c0, 2\n"       // TTBCR
+            "mcrr p15, 0, %Q2, %R2, c2\n"       // TTBR0
+            "isb\n"
+            "mcr p15, 0, %3, c8, c7, 0\n"       // TLBIALL
+            "dsb\n"
+            "isb\n"
+            :: "r" (MAIR_VALUE), "r" (ttbcr), "r" (ttbr), "r" (0) : "memory");
+        __asm__ __volatile__ ("mrc p15, 0, %0, c1, c0, 0" : "=r" (sctlr));
+        sctlr |= SCTLR_M | SCTLR_C | SCTLR_Z | SCTLR_I;
+        __asm__ __volatile__ ("mcr p15, 0, %0, c1, c0, 0\n isb" :: "r" (sctlr) : "memory");
+    }
+}
+
+#endif
+
+#endif
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Smallest data cache line size of the supported cores
+#if RASPI == 1
+#define CACHE_LINE_SIZE 32
+#else
+#define CACHE_LINE_SIZE 64
+#endif
+
+// Identity maps memory (DRAM cacheable, peripherals as device memory)
+// and enables the MMU, data and instruction caches
+void mmu_init();
+
+// Cleans and invalidates the entire data cache (vectors.S)
+void cache_clean_invalidate_all();
+
+// Make sure writes to one peripheral (or memory) have completed before
+// accessing another
+static inline void data_sync_barrier()
+{
+#if AARCH == 64
+    __asm__ __volatile__ ("dsb sy" ::: "memory");
+#else
+    __asm__ __volatile__ ("mcr p15, 0, %0, c7, c10, 4" :: "r" (0) : "memory");
+#endif
+}
+
+// Data cache maintenance by address range, used around DMA and mailbox
+// transfers.  These are inline and don't touch the stack so they can't
+// dirty lines of a range that's being invalidated.
+#if AARCH == 64
+#define CACHE_RANGE_OP(name, op) \
+static inline void name(const void* p, size_t length) \
+{ \
+    size_t addr = (size_t)p & ~(size_t)(CACHE_LINE_SIZE - 1); \
+    size_t end = (size_t)p + length; \
+    for (; addr < end; addr += CACHE_LINE_SIZE) \
+        __asm__ __volatile__ ("dc " op ", %0" :: "r" (addr) : "memory"); \
+    data_sync_barrier(); \
+}
+CACHE_RANGE_OP(cache_clean_range, "cvac")
+CACHE_RANGE_OP(cache_invalidate_range, "ivac")
+CACHE_RANGE_OP(cache_clean_invalidate_range, "civac")
+#else
+#define CACHE_RANGE_OP(name, op) \
+static inline void name(const void* p, size_t length) \
+{ \
+    size_t addr = (size_t)p & ~(size_t)(CACHE_LINE_SIZE - 1); \
+    size_t end = (size_t)p + length; \
+    for (; addr < end; addr += CACHE_LINE_SIZE) \
+        __asm__ __volatile__ ("mcr p15, 0, %0, c7, " op :: "r" (addr) : "memory"); \
+    data_sync_barrier(); \
+}
+CACHE_RANGE_OP(cache_clean_range, "c10, 1")
+CACHE_RANGE_OP(cache_invalidate_range, "c6, 1")
+CACHE_RANGE_OP(cache_clean_invalidate_range, "c14, 1")
+#endif
@@ -1,4 +1,5 @@
 #include <malloc.h>
+#include <string.h>
 
 #include "packenc.h"
 #include "crc32.h"
@@ -95,6 +96,160 @@ void packet_encode(void (*callback)(uint8_t data), uint32_t seq, uint32_t cmd, c
     callback(terminator_byte);
 }
 
+// Span encoder context
+typedef struct 
+{
+    void (*callback)(const void* pData, uint32_t cbData);
+    uint32_t crc;
+    uint32_t crc_from;          // Offset in buf of first byte not yet CRC'd
+    bool crc_active;            // Whether output bytes are included in CRC
+    uint8_t signal_bytes;
+    uint32_t used;
+    uint8_t buf[packet_encode_chunk_size];
+} span_encoder_context;
+
+// Update CRC with any pending bytes in the chunk buffer
+static void span_update_crc(span_encoder_context* pctx)
+{
+    if (pctx->crc_active)
+        crc32_update(&pctx->crc, pctx->buf + pctx->crc_from, pctx->used - pctx->crc_from);
+    pctx->crc_from = pctx->used;
+}
+
+// Pass the chunk buffer to the callback
+static void span_flush(span_encoder_context* pctx)
+{
+    span_update_crc(pctx);
+    if (pctx->used)
+        pctx->callback(pctx->buf, pctx->used);
+    pctx->used = 0;
+    pctx->crc_from = 0;
+}
+
+// Write a byte without stuffing
+static void span_write_raw(span_encoder_context* pctx, uint8_t data)
+{
+    if (pctx->used == sizeof(pctx->buf))
+        span_flush(pctx);
+    pctx->buf[pctx->used++] = data;
+}
+
+// Write a byte, inserting stuffing byte if needed
+static void span_write(span_encoder_context* pctx, uint8_t data)
+{
+    span_write_raw(pctx, data);
+
+    if (data == signal_byte)
+    {
+        if (pctx->signal_bytes == 1)
+        {
+            span_write_raw(pctx, stuff_byte);
+            pctx->signal_bytes = 0;
+        }
+        else
+        {
+            pctx->signal_bytes++;
+        }
+    }
+    else
+        pctx->signal_bytes = 0;
+}
+
+// Write a run of bytes, copying everything up to each signal byte in bulk
+static void span_write_run(span_encoder_context* pctx, const uint8_t* p, uint32_t cb)
+{
+    while (cb)
+    {
+        // Make room
+        if (pctx->used == sizeof(pctx->buf))
+            span_flush(pctx);
+
+        // Find the next signal byte within what fits in the chunk
+        uint32_t n = sizeof(pctx->buf) - pctx->used;
+        if (n > cb)
+            n = cb;
+        const uint8_t* pSignal = memchr(p, signal_byte, n);
+        if (pSignal)
+            n = pSignal - p;
+
+        // Copy bytes before it
+        if (n)
+        {
+            memcpy(pctx->buf + pctx->used, p, n);
+            pctx->used += n;
+            pctx->signal_bytes = 0;
+            p += n;
+            cb -= n;
+        }
+
+        // Write the signal byte (and stuffing)
+        if (pSignal)
+        {
+            span_write(pctx, *p++);
+            cb--;
+        }
+    }
+}
+
+// Helper to variable length encode a value
+static void span_write_varlen(span_encoder_context *pctx, uint32_t value, uint8_t bit)
+{
+    if (value > 127)
+    {
+        span_write_varlen(pctx, value >> 7, 0x80);
+    }
+    span_write(pctx, (value & 0x7F) | bit);
+}
+
+// Encode a single packet of data in spans.  Instead of updating the CRC
+// as each byte is written, it's calculated over each chunk of encoded
+// output (stuffing bytes included, same as packet_encode)
+void packet_encode_buf(void (*callback)(const void* pData, uint32_t cbData), uint32_t seq, uint32_t cmd, const void *pData, uint32_t cbData)
+{
+    // Setup context
+    span_encoder_context ctx;
+    ctx.callback = callback;
+    crc32_start(&ctx.crc);
+    ctx.crc_from = 0;
+    ctx.crc_active = false;
+    ctx.signal_bytes = 0;
+    ctx.used = 0;
+
+    // Write signal
+    span_write_raw(&ctx, signal_byte);
+    span_write_raw(&ctx, signal_byte);
+    span_write_raw(&ctx, signal_byte);
+
+    // Start CRC
+    span_update_crc(&ctx);
+    ctx.crc_active = true;
+
+    // Write header
+    span_write(&ctx, separator_byte);
+    span_write_varlen(&ctx, seq, 0);
+    span_write_varlen(&ctx, cmd, 0);
+    span_write_varlen(&ctx, cbData, 0);
+
+    // Write data
+    span_write_run(&ctx, (const uint8_t*)pData, cbData);
+
+    // Finish CRC
+    span_update_crc(&ctx);
+    ctx.crc_active = false;
+    crc32_finish(&ctx.crc);
+
+    // Write crc
+    uint32_t crc = ctx.crc;
+    span_write(&ctx, (crc >> 24) & 0xFF);
+    span_write(&ctx, (crc >> 16) & 0xFF);
+    span_write(&ctx, (crc >> 8) & 0xFF);
+    span_write(&ctx, (crc >> 0) & 0xFF);
+
+    // Write terminator
+    span_write_raw(&ctx, terminator_byte);
+    span_flush(&ctx);
+}
+
 // Decoder state machine states
 enum decode_state
 {
@@ -109,6 +264,22 @@ enum decode_state
 };
 
 
+// Ask the redirect handler where the rest of the data should go
+static void check_redirect(decode_context* pctx)
+{
+    if (pctx->onRedirect && pctx->count == pctx->cbRedirectHeader && pctx->length > pctx->count)
+        pctx->pRedirect = (uint8_t*)pctx->onRedirect(pctx->seq, pctx->cmd, pctx->pBuf, pctx->length);
+}
+
+// Get the location to write packet data at the current position
+static inline uint8_t* data_ptr(decode_context* pctx)
+{
+    if (pctx->pRedirect)
+        return pctx->pRedirect + (pctx->count - pctx->cbRedirectHeader);
+    else
+        return pctx->pBuf + pctx->count;
+}
+
 // Decoder packets
 void packet_decode(decode_context* pctx, uint8_t data)
 {
@@ -210,14 +381,16 @@ void packet_decode(decode_context* pctx, uint8_t data)
             {
                 pctx->state = pctx->length == 0 ? decode_state_expect_crc : decode_state_expect_data;
                 pctx->count = 0;
+                pctx->pRedirect = NULL;
             }
         }
         break;
 
     case decode_state_expect_data:
         crc32_update_1(&pctx->crcCalc, data);
-        pctx->pBuf[pctx->count] = data;
+        *data_ptr(pctx) = data;
         pctx->count++;
+        check_redirect(pctx);
         if (pctx->count == pctx->length)
         {
             pctx->state = decode_state_expect_crc;
@@ -257,3 +430,45 @@ void packet_decode(decode_context* pctx, uint8_t data)
         break;
     }
 }
+
+// Decode a span of packet data
+void packet_decode_buf(decode_context* pctx, const uint8_t* p, uint32_t cb)
+{
+    while (cb)
+    {
+        // Fast path for packet payload, copy everything up to the next
+        // signal byte (which needs the state machine for stuffing)
+        if (pctx->state == decode_state_expect_data && pctx->signal_bytes_seen == 0)
+        {
+            uint32_t n = pctx->length - pctx->count;
+            if (pctx->onRedirect && pctx->count < pctx->cbRedirectHeader && n > pctx->cbRedirectHeader - pctx->count)
+                n = pctx->cbRedirectHeader - pctx->count;
+            if (n > cb)
+                n = cb;
+            const uint8_t* pSignal = memchr(p, signal_byte, n);
+            if (pSignal)
+                n = pSignal - p;
+
+            if (n)
+            {
+                memcpy(data_ptr(pctx), p, n);
+                crc32_update(&pctx->crcCalc, p, n);
+                pctx->count += n;
+                p += n;
+                cb -= n;
+                check_redirect(pctx);
+
+                if (pctx->count == pctx->length)
+                {
+                    pctx->state = decode_state_expect_crc;
+                    pctx->count = 0;
+                }
+                continue;
+            }
+        }
+
+        // Slow path
+        packet_decode(pctx, *p++);
+        cb--;
+    }
+}
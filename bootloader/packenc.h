@@ -10,6 +10,12 @@ extern "C" {
 // Encodes a packet of data, calling 'callback' with the encoded bytes
 void packet_encode(void(*callback)(uint8_t data), uint32_t seq, uint32_t cmd, const void* pData, uint32_t cbData);
 
+// Encodes a packet of data, calling 'callback' with spans of encoded bytes
+// (at most packet_encode_chunk_size bytes at a time).  Produces exactly
+// the same output as packet_encode.
+#define packet_encode_chunk_size 64
+void packet_encode_buf(void(*callback)(const void* pData, uint32_t cbData), uint32_t seq, uint32_t cmd, const void* pData, uint32_t cbData);
+
 enum packet_error
 {
     packet_error_none,                          // 0
@@ -33,18 +39,31 @@ typedef struct
     uint32_t length;
     uint32_t crcRecv;
     uint32_t crcCalc;
+    uint8_t* pRedirect;
 
     // These need to be populated
     void (*onPacket)(uint32_t seq, uint32_t cmd, const void *pdata, uint32_t cbData);
     void (*onError)(int code);      // can be null if not interested
     uint8_t* pBuf;
     size_t cbBuf;
+
+    // Optional, called once the first cbRedirectHeader bytes of a packet's
+    // data have been received.  Can return a pointer where the rest of the
+    // data should be written instead of pBuf (or NULL to use pBuf).  When
+    // redirected, onPacket only receives the header in pBuf and the data
+    // may have been written even if the packet fails its CRC check.
+    void* (*onRedirect)(uint32_t seq, uint32_t cmd, const void* pHeader, uint32_t cbData);
+    uint32_t cbRedirectHeader;
 } decode_context;
 
 // Decode packet data
 // Invalid data and packets will be discarded
 void packet_decode(decode_context* pctx, uint8_t data);
 
+// Decode a span of packet data (same as calling packet_decode for 
+// each byte, but packet payloads are bulk copied)
+void packet_decode_buf(decode_context* pctx, const uint8_t* pData, uint32_t cbData);
+
 #ifdef __cplusplus
 }
 #endif
@@ -5,8 +5,10 @@
 
 #include <stddef.h>
 #include <string.h>
+#include <malloc.h>
 
 #include "raspi.h"
+#include "mmu.h"
 
 #include "../lib/ceelib/ceelib/heap.h"
 
@@ -26,6 +28,9 @@ int start_main()
 	extern unsigned char __bss_end;
 	memset(&__bss_start, 0, &__bss_end - &__bss_start);
 
+    // Turn on the MMU and caches
+    mmu_init();
+
     heap_init(&ceelib_malloc_heap, (void*)0x08000000, 0x08000000);
 
     // Call the real main
@@ -77,6 +82,8 @@ void delay_micros(uint64_t period)
     uint64_t start = micros();
     while (micros() - start < period)
     {
+        // Don't lose received bytes while waiting
+        uart_poll();
     }
 }
 
@@ -154,12 +161,27 @@ uint32_t end_of_message_marker
 #define CLOCK_ID_CORE		4
 
 
+// Property buffer passed to the VideoCore.  Requests are copied here so the
+// buffer is always cache line aligned and padded to whole lines, invalidating
+// it after the call can't discard neighbouring data (eg: on the caller's stack)
+#define MBOX_BUFFER_SIZE 4096
+static uint8_t mbox_buffer[MBOX_BUFFER_SIZE] __attribute__((aligned(CACHE_LINE_SIZE)));
+
 unsigned mbox_writeread(unsigned nData)
 {
+	// The VideoCore reads and writes the property buffer in memory. The
+	// buffer's first word is its length.
+	void* pBuffer = (void*)(size_t)nData;
+	size_t cbBuffer = *(uint32_t*)pBuffer;
+	if (cbBuffer > MBOX_BUFFER_SIZE)
+		return 0;
+	memcpy(mbox_buffer, pBuffer, cbBuffer);
+	cache_clean_invalidate_range(mbox_buffer, cbBuffer);
+
 	while (GET32(MAILBOX1_STATUS) & MAILBOX_STATUS_FULL)
         ;
 
-	PUT32(MAILBOX1_WRITE, BCM_MAILBOX_PROP_OUT | nData);
+	PUT32(MAILBOX1_WRITE, BCM_MAILBOX_PROP_OUT | (unsigned)(size_t)mbox_buffer);
 
 	unsigned nResult;
 	do
@@ -171,7 +193,10 @@ unsigned mbox_writeread(unsigned nData)
 	}
 	while ((nResult & 0xF) != BCM_MAILBOX_PROP_OUT);
 
-	return nResult & ~0xF;
+	cache_invalidate_range(mbox_buffer, cbBuffer);
+	memcpy(pBuffer, mbox_buffer, cbBuffer);
+
+	return nData;
 }
 
 struct SinglePropertyTag
@@ -834,6 +859,72 @@ static unsigned get_uart_clock()
     return proptag[6];
 }
 
+// Software receive buffer.  The PL011 only has a 16 byte receive FIFO
+// which overflows in a few microseconds at high baud rates.  While the CPU
+// is busy (eg: writing to the SD card) uart_poll() moves received bytes
+// here so pipelined packets from the host aren't lost.  Starts with a
+// static buffer, replaced by a heap allocated one if more room is needed
+// for larger packets.
+static uint8_t uart_rx_default_buffer[UART_RX_BUFFER_SIZE];
+static uint8_t* uart_rx_buffer = uart_rx_default_buffer;
+static uint32_t uart_rx_size = UART_RX_BUFFER_SIZE;
+static uint32_t uart_rx_head = 0;
+static uint32_t uart_rx_tail = 0;
+
+void uart_set_rx_buffer_size(uint32_t size)
+{
+    // Clamp
+    if (size < UART_RX_BUFFER_SIZE)
+        size = UART_RX_BUFFER_SIZE;
+    if (size > UART_RX_BUFFER_MAX)
+        size = UART_RX_BUFFER_MAX;
+    if (size == uart_rx_size)
+        return;
+
+    // Allocate new buffer
+    uint8_t* pNew = size == UART_RX_BUFFER_SIZE ? uart_rx_default_buffer : (uint8_t*)malloc(size);
+    if (pNew == NULL)
+        return;
+
+    // Move pending bytes
+    uint32_t count = 0;
+    while (uart_rx_tail != uart_rx_head && count < size - 1)
+    {
+        pNew[count++] = uart_rx_buffer[uart_rx_tail++];
+        if (uart_rx_tail == uart_rx_size)
+            uart_rx_tail = 0;
+    }
+
+    // Switch to new buffer
+    if (uart_rx_buffer != uart_rx_default_buffer)
+        free(uart_rx_buffer);
+    uart_rx_buffer = pNew;
+    uart_rx_size = size;
+    uart_rx_tail = 0;
+    uart_rx_head = count;
+}
+
+void uart_poll()
+{
+    while ((GET32(ARM_UART_FR) & FR_RXFE_MASK) == 0)
+    {
+        // Read byte, discard errors
+        uint32_t nDR = GET32(ARM_UART_DR);
+        if (nDR & (DR_BE_MASK|DR_OE_MASK|DR_FE_MASK|DR_PE_MASK))
+            continue;
+
+        // Discard if buffer full (packet CRC will catch it)
+        uint32_t next = uart_rx_head + 1;
+        if (next == uart_rx_size)
+            next = 0;
+        if (next == uart_rx_tail)
+            continue;
+
+        uart_rx_buffer[uart_rx_head] = nDR & 0xFF;
+        uart_rx_head = next;
+    }
+}
+
 void uart_init(unsigned baud)
 {
     uart_init_ex(baud, 8, 1, 0);
@@ -899,6 +990,15 @@ void uart_init_ex(unsigned baud, int dataBits, int stopBits, int parity)
 
 int uart_try_recv()
 {
+    // Anything in the software receive buffer?
+    if (uart_rx_tail != uart_rx_head)
+    {
+        uint8_t byte = uart_rx_buffer[uart_rx_tail++];
+        if (uart_rx_tail == uart_rx_size)
+            uart_rx_tail = 0;
+        return byte;
+    }
+
     // Available?
     if(GET32(ARM_UART_FR) & FR_RXFE_MASK)
         return -1;
@@ -924,6 +1024,26 @@ int uart_try_recv()
     return -6;
 }
 
+// Receive as many bytes as are available (up to cbBuf), returns
+// the number of bytes received.  Bytes with errors are discarded.
+uint32_t uart_try_recv_buf(void* pBuf, uint32_t cbBuf)
+{
+    // Move everything from the FIFO to the receive buffer
+    uart_poll();
+
+    // Copy out the contiguous part of the buffer
+    uint32_t available = uart_rx_head >= uart_rx_tail ? 
+            uart_rx_head - uart_rx_tail : 
+            uart_rx_size - uart_rx_tail;
+    if (available > cbBuf)
+        available = cbBuf;
+    memcpy(pBuf, uart_rx_buffer + uart_rx_tail, available);
+    uart_rx_tail += available;
+    if (uart_rx_tail == uart_rx_size)
+        uart_rx_tail = 0;
+    return available;
+}
+
 uint8_t uart_recv()
 {
     int ch;
@@ -945,12 +1065,30 @@ void uart_send(unsigned int c)
 {
     while(GET32(ARM_UART_FR) & FR_TXFF_MASK)
     {
-        // do nothing
+        // Don't lose received bytes while waiting
+        uart_poll();
     }
 
     PUT32(ARM_UART_DR, c);
 }
 
+void uart_send_buf(const void* pData, uint32_t cbData)
+{
+    const uint8_t* p = (const uint8_t*)pData;
+    while (cbData)
+    {
+        // Fill the FIFO
+        while (cbData && (GET32(ARM_UART_FR) & FR_TXFF_MASK) == 0)
+        {
+            PUT32(ARM_UART_DR, *p++);
+            cbData--;
+        }
+
+        // Don't lose received bytes while waiting
+        uart_poll();
+    }
+}
+
 void uart_flush()
 {
 	while(GET32(ARM_UART_FR) & FR_BUSY_MASK)
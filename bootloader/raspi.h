@@ -88,6 +88,8 @@ void mini_uart_flush();
 void mini_uart_send_str(const char* psz);
 
 // UART
+#define UART_RX_BUFFER_SIZE 65536
+#define UART_RX_BUFFER_MAX (1024*1024)
 void uart_init(unsigned baud);
 void uart_init_ex(unsigned baud, int dataBits, int stopBits, int parity);
 int uart_try_recv();
@@ -96,6 +98,10 @@ void uart_send(unsigned int c);
 unsigned int uart_lcr();
 unsigned int uart_check();
 void uart_flush();
+void uart_poll();
+void uart_set_rx_buffer_size(uint32_t size);
+uint32_t uart_try_recv_buf(void* pBuf, uint32_t cbBuf);
+void uart_send_buf(const void* pData, uint32_t cbData);
 void uart_send_hex32(unsigned int d);
 void uart_sendln_hex32(unsigned int d);
 void uart_send_hex4(int rc);
@@ -1,5 +1,6 @@
 #include "raspi.h"
 #include "sdcard.h"
+#include "mmu.h"
 
 // Referencs:
 // https://yannik520.github.io/sdio.html
@@ -65,6 +66,63 @@ static bool g_is_sdhc = false;      // True if initialized card supports sdhc
 #define EMMC_SPI_INT_SPT 		MMIO_32(EMMC_BASE + 0xf0)
 #define EMMC_SLOTISR_VER 		MMIO_32(EMMC_BASE + 0xfc)
 
+// Multi-block transfers use the BCM DMA engine, paced by the EMMC's
+// DREQ.  The Pi 4's EMMC2 controller isn't wired to this DREQ so it
+// always uses PIO.
+#ifndef SD_USE_DMA
+#if RASPI <= 3
+#define SD_USE_DMA 1
+#else
+#define SD_USE_DMA 0
+#endif
+#endif
+
+#if SD_USE_DMA
+
+// DMA Registers (Section 4.2.1.2, p47)
+#define DMA_CHANNEL             5
+#define DMA_BASE                (0x7000 + DMA_CHANNEL * 0x100)
+#define DMA_CS                  MMIO_32(DMA_BASE + 0x00)
+#define DMA_CONBLK_AD           MMIO_32(DMA_BASE + 0x04)
+#define DMA_TXFR_LEN            MMIO_32(DMA_BASE + 0x14)
+#define DMA_DEBUG               MMIO_32(DMA_BASE + 0x20)
+#define DMA_ENABLE              MMIO_32(0x7FF0)
+
+// DMA CS register flags
+#define DMA_CS_RESET            (1 << 31)
+#define DMA_CS_WAIT_OUTSTANDING (1 << 28)
+#define DMA_CS_PANIC_PRIORITY(x) ((x) << 20)
+#define DMA_CS_PRIORITY(x)      ((x) << 16)
+#define DMA_CS_ERROR            (1 << 8)
+#define DMA_CS_END              (1 << 1)
+#define DMA_CS_ACTIVE           (1 << 0)
+
+// DMA DEBUG register error flags (write 1 to clear)
+#define DMA_DEBUG_ERRORS        0x07
+
+// DMA transfer information flags
+#define DMA_TI_PERMAP(x)        ((x) << 16)
+#define DMA_TI_SRC_DREQ         (1 << 10)
+#define DMA_TI_SRC_INC          (1 << 8)
+#define DMA_TI_DEST_DREQ        (1 << 6)
+#define DMA_TI_DEST_INC         (1 << 4)
+#define DMA_TI_WAIT_RESP        (1 << 3)
+
+// DREQ peripheral number of the EMMC controller
+#define DMA_DREQ_EMMC           11
+
+// Convert ARM addresses to VideoCore bus addresses as seen by the DMA
+// engine. On the Pi 1 RAM is accessed through the L2 coherent alias,
+// later models bypass the L2.
+#if RASPI == 1
+#define BUS_ADDRESS(p)          (((uint32_t)(size_t)(p) & 0x3FFFFFFF) | 0x40000000)
+#else
+#define BUS_ADDRESS(p)          (((uint32_t)(size_t)(p) & 0x3FFFFFFF) | 0xC0000000)
+#endif
+#define PERIPHERAL_BUS_ADDRESS(reg) ((uint32_t)((size_t)(reg) - PBASE) | 0x7E000000)
+
+#endif
+
 // Control 0 register flags
 #define CONTROL0_ALT_BOOT_EN    (1 << 22)
 #define CONTROL0_BOOT_EN        (1 << 21)
@@ -382,6 +440,115 @@ static int issue_command(uint32_t command, uint32_t arg)
 }
 
 
+#if SD_USE_DMA
+
+// DMA control block (Section 4.2.1.1, p40) - must be 32 byte aligned
+typedef struct
+{
+    uint32_t ti;
+    uint32_t source_ad;
+    uint32_t dest_ad;
+    uint32_t txfr_len;
+    uint32_t stride;
+    uint32_t nextconbk;
+    uint32_t reserved[2];
+} __attribute__((aligned(32))) DMA_CONTROL_BLOCK;
+
+static DMA_CONTROL_BLOCK g_dma_cb;
+static bool g_dma_failed = false;   // Set if the DMA engine misbehaves, forcing PIO
+
+// Check if a transfer can be done by DMA
+static bool can_use_dma(const void* pBuffer, uint16_t blockCount)
+{
+    // Single blocks aren't worth the setup cost.  Buffers must be cache
+    // line aligned so invalidating the cache after a read can't discard
+    // other data sharing the first line (transfers are whole blocks so the
+    // end is aligned too)
+    return !g_dma_failed && blockCount > 1 && ((size_t)pBuffer & (CACHE_LINE_SIZE - 1)) == 0;
+}
+
+// Run a DMA transfer between memory and the EMMC data register, servicing
+// the UART while it runs.
+static int dma_transfer(uint32_t ti, uint32_t source, uint32_t dest, uint32_t length)
+{
+    // Setup control block
+    g_dma_cb.ti = ti | DMA_TI_PERMAP(DMA_DREQ_EMMC) | DMA_TI_WAIT_RESP;
+    g_dma_cb.source_ad = source;
+    g_dma_cb.dest_ad = dest;
+    g_dma_cb.txfr_len = length;
+    g_dma_cb.stride = 0;
+    g_dma_cb.nextconbk = 0;
+    cache_clean_range(&g_dma_cb, sizeof(g_dma_cb));
+
+    // Enable and reset the channel
+    put(DMA_ENABLE, *DMA_ENABLE | (1 << DMA_CHANNEL));
+    put(DMA_CS, DMA_CS_RESET);
+    put(DMA_DEBUG, DMA_DEBUG_ERRORS);
+
+    // Start it
+    put(DMA_CONBLK_AD, BUS_ADDRESS(&g_dma_cb));
+    put(DMA_CS, DMA_CS_WAIT_OUTSTANDING | DMA_CS_PANIC_PRIORITY(15) | DMA_CS_PRIORITY(1) | DMA_CS_ACTIVE);
+
+    // Wait for it to finish.  Times out if no progress for a second (same
+    // as the per block timeout of the PIO path)
+    uint32_t remaining = length;
+    uint64_t last_progress = micros();
+    while (*DMA_CS & DMA_CS_ACTIVE)
+    {
+        // Card error?
+        if (*EMMC_INTERRUPT & INTERRUPT_FLAG_ERR)
+        {
+            put(DMA_CS, DMA_CS_RESET);
+            data_sync_barrier();
+            ERROR("DMA transfer card error: %08x\n", *EMMC_INTERRUPT);
+            return (ti & DMA_TI_SRC_DREQ) ? E_SD_READ_ERROR : E_SD_WRITE_ERROR;
+        }
+
+        // Don't lose received serial bytes during long transfers
+        uart_poll();
+
+        // Check progress
+        uint32_t now_remaining = *DMA_TXFR_LEN;
+        if (now_remaining != remaining)
+        {
+            remaining = now_remaining;
+            last_progress = micros();
+        }
+        else if (micros() - last_progress > 1000000)
+        {
+            put(DMA_CS, DMA_CS_RESET);
+            data_sync_barrier();
+            ERROR("DMA transfer timeout: %08x %08x\n", *DMA_CS, *EMMC_INTERRUPT);
+            return E_SD_DMA_FAILED;
+        }
+    }
+    data_sync_barrier();
+
+    // Check the engine didn't fault
+    if (*DMA_CS & DMA_CS_ERROR)
+    {
+        ERROR("DMA transfer error: %08x %08x\n", *DMA_CS, *DMA_DEBUG);
+        put(DMA_CS, DMA_CS_RESET);
+        return E_SD_DMA_FAILED;
+    }
+
+    return 0;
+}
+
+// Stop a failed DMA transfer so the command can be retried with PIO
+static void abort_dma_transfer()
+{
+    ERROR("Disabling SD DMA, falling back to PIO\n");
+    g_dma_failed = true;
+
+    // Reset the data line and tell the card to stop
+    set_register_bits(EMMC_CONTROL1, CONTROL1_SRST_DATA, CONTROL1_SRST_DATA);
+    wait_register_all_clear(EMMC_CONTROL1, CONTROL1_SRST_DATA, 1000);
+    issue_command(CMD_STOP_TRANSMISSION, 0);
+}
+
+#endif
+
 // Issue a read command
 static int issue_read_command(uint32_t command, uint32_t arg, void* pBuffer, uint16_t blockSize, uint16_t blockCount)
 {
@@ -404,6 +571,28 @@ static int issue_read_command(uint32_t command, uint32_t arg, void* pBuffer, uin
 
     TRACE("Starting read transfer...\n");
 
+#if SD_USE_DMA
+    // Transfer data by DMA
+    if (can_use_dma(pBuffer, blockCount))
+    {
+        // Make sure no dirty lines get written back over the data, and
+        // discard anything speculatively loaded during the transfer
+        cache_clean_invalidate_range(pBuffer, blockSize * blockCount);
+        err = dma_transfer(DMA_TI_SRC_DREQ | DMA_TI_DEST_INC, PERIPHERAL_BUS_ADDRESS(EMMC_DATA), BUS_ADDRESS(pBuffer), blockSize * blockCount);
+        if (err == E_SD_DMA_FAILED)
+        {
+            abort_dma_transfer();
+            return issue_read_command(command, arg, pBuffer, blockSize, blockCount);
+        }
+        cache_invalidate_range(pBuffer, blockSize * blockCount);
+        if (err)
+            return err;
+
+        // Wait for the auto CMD12 to finish
+        return wait_data_done();
+    }
+#endif
+
     // Transfer data
     uint32_t* p = (uint32_t*)pBuffer;
     for (uint16_t i=0; i<blockCount; i++)
@@ -430,6 +619,9 @@ static int issue_read_command(uint32_t command, uint32_t arg, void* pBuffer, uin
         {
             *p++ = *EMMC_DATA;
         }
+
+        // Don't lose received serial bytes during long transfers
+        uart_poll();
     }    
 
     TRACE("Read transfer finished (interrupt: %08x)\n", *EMMC_INTERRUPT);
@@ -468,6 +660,26 @@ static int issue_write_command(uint32_t command, uint32_t arg, const void* pBuff
 
     TRACE("Starting write transfer...\n");
 
+#if SD_USE_DMA
+    // Transfer data by DMA
+    if (can_use_dma(pBuffer, blockCount))
+    {
+        // Write back cached data so the DMA engine sees it
+        cache_clean_range(pBuffer, blockSize * blockCount);
+        err = dma_transfer(DMA_TI_DEST_DREQ | DMA_TI_SRC_INC, BUS_ADDRESS(pBuffer), PERIPHERAL_BUS_ADDRESS(EMMC_DATA), blockSize * blockCount);
+        if (err == E_SD_DMA_FAILED)
+        {
+            abort_dma_transfer();
+            return issue_write_command(command, arg, pBuffer, blockSize, blockCount);
+        }
+        if (err)
+            return err;
+
+        // Wait till finished
+        return wait_data_done();
+    }
+#endif
+
     // Transfer data
     uint32_t* p = (uint32_t*)pBuffer;
     for (uint16_t i=0; i<blockCount; i++)
@@ -494,6 +706,9 @@ static int issue_write_command(uint32_t command, uint32_t arg, const void* pBuff
         {
             put(EMMC_DATA, *p++);
         }
+
+        // Don't lose received serial bytes during long transfers
+        uart_poll();
     }    
 
     TRACE("Write transfer finished (interrupt: %08x)\n", *EMMC_INTERRUPT);
@@ -18,6 +18,7 @@
 #define E_SD_WRITE_TIMEOUT		15
 #define E_SD_INTERNAL			16
 #define E_SD_NOT_INITIALIZED	17
+#define E_SD_DMA_FAILED			18
 
 // Initializes the sd card if not already initialized and then
 // resets its.  Also sets up pin modes
@@ -1,4 +1,5 @@
 #include "common.h"
+#include "mmu.h"
 
 const char* stralloc(const char* psz)
 {
@@ -9,4 +10,15 @@ const char* stralloc(const char* psz)
     char* pMem = (char*)malloc(len);
     memcpy(pMem, psz, len);
     return pMem;
-}
\ No newline at end of file
+}
+
+// Over-allocates by a cache line and rounds up.  The original pointer
+// isn't kept, so the result must never be passed to free() (callers
+// allocate their buffers once and keep them)
+void* malloc_cache_aligned(size_t size)
+{
+    size_t p = (size_t)malloc(size + CACHE_LINE_SIZE - 1);
+    if (p == 0)
+        return NULL;
+    return (void*)((p + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1));
+}
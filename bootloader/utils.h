@@ -1,3 +1,7 @@
 #pragma once
 
 const char* stralloc(const char* psz);
+
+// Allocate a buffer aligned to a cache line (so it can be used for DMA),
+// the result can't be passed to free()
+void* malloc_cache_aligned(size_t size);
@@ -154,10 +154,20 @@ function pathjoin(a, b)
 }
 
 
+// Split a path into its directory (null if none) and last component
+function pathsplit(p)
+{
+    let ix = p.lastIndexOf('/');
+    if (ix < 0)
+        return { dir: null, name: p };
+    return { dir: p.substring(0, ix) || '/', name: p.substring(ix + 1) };
+}
 
 export default {
     glob,
+    pathiswild,
     expandArg,
     expandArgs,
     pathjoin,
+    pathsplit,
 }
\ No newline at end of file
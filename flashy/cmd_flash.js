@@ -1,30 +1,471 @@
 import path from 'node:path';
 import fs from 'node:fs';
+import crypto from 'node:crypto';
 import { fileURLToPath } from 'node:url';
 
 import commandLineParser from './commandLineParser.js';
 import intelHex from './intelHex.js';
+import elfFile from './elfFile.js';
+import lz4 from './lz4.js';
+import crc32 from './crc32.js';
 
 const __dirname = path.dirname(fileURLToPath(import.meta.url));
 
-// Send a hex file to device
-async function sendHexFile(ctx, hexFile)
+// Largest amount of data to decompress from a single packet (limits
+// how long the device takes to ack a packet of highly compressible data)
+const max_uncompressed_block = 256 * 1024;
+
+// Runs of the same byte at least this long are sent as fill packets
+const fill_threshold = 64;
+
+// Largest amount of memory to verify with a single memory CRC request
+const max_verify_block = 1024 * 1024;
+
+// Size of the blocks compared against device memory when only sending
+// changed program data
+const delta_block_size = 4096;
+
+// Find the length of the run of identical bytes at buf[start]
+function runLength(buf, start, end)
+{
+    let i = start + 1;
+    while (i < end && buf[i] == buf[start])
+        i++;
+    return i - start;
+}
+
+// Find the start of the next run that should be sent as a fill packet,
+// (or end if none)
+function findRun(buf, start, end)
+{
+    let runStart = start;
+    for (let i = start + 1; i < end; i++)
+    {
+        if (buf[i] != buf[runStart])
+            runStart = i;
+        else if (i + 1 - runStart >= fill_threshold)
+            return runStart;
+    }
+    return end;
+}
+
+// Record program data sent to the device so it can be verified after
+// the upload, merging with the previous region if contiguous
+function recordProgramData(stats, addr, data)
+{
+    // Not verifying?
+    if (!stats.regions)
+        return;
+
+    // Contiguous with previous region?
+    let last = stats.regions[stats.regions.length - 1];
+    if (last && last.addr + last.length == addr)
+    {
+        last.parts.push(Buffer.from(data));
+        last.length += data.length;
+        return;
+    }
+
+    stats.regions.push({ addr, length: data.length, parts: [ Buffer.from(data) ] });
+}
+
+// Fill a block of device memory with the same byte value
+async function sendFill(ctx, stats, addr, length, value)
+{
+    let cl = ctx.cl;
+    let layer = ctx.layer;
+
+    if (stats.regions)
+        recordProgramData(stats, addr, Buffer.alloc(length, value));
+
+    // Just collecting program data?
+    if (stats.collectOnly)
+        return;
+
+    for (let i=0; i<cl.stress; i++)
+    {
+        stats.programBytesSent += length;
+        stats.wireBytesSent += 9;
+        await layer.sendFill(addr, length, value);
+        process.stdout.write('.');
+    }
+}
+
+// Send a block of program data from buf[start..end) to the device at addr,
+// compressed if that reduces the number of bytes on the wire.  Returns 
+// the number of bytes of buf that were sent.
+async function sendProgramData(ctx, stats, addr, buf, start, end)
 {
     let cl = ctx.cl;
     let layer = ctx.layer;
 
+    // Just collecting program data?
+    if (stats.collectOnly)
+    {
+        recordProgramData(stats, addr, buf.subarray(start, end));
+        return end - start;
+    }
+
+    // Send runs as fill packets
+    let run = runLength(buf, start, end);
+    if (run >= fill_threshold)
+    {
+        await sendFill(ctx, stats, addr, run, buf[start]);
+        return run;
+    }
+
+    // Stop at the next run
+    end = findRun(buf, start, Math.min(end, start + max_uncompressed_block));
+
+    // Raw data packet
+    let raw_length = Math.min(end - start, layer.max_packet_size - 8);
+    let packet_id = "raw";
+    let length = raw_length;
+    let packet = null;
+
+    // Try compressing it
+    if (!cl.noCompress)
+    {
+        let r = lz4.compress(buf, start, Math.min(end, start + max_uncompressed_block), layer.max_packet_size - 8);
+
+        // Use it if more data per wire byte
+        if (r.consumed * (raw_length + 8) > raw_length * (r.data.length + 8))
+        {
+            packet = Buffer.alloc(r.data.length + 8);
+            packet.writeUInt32LE(addr, 0);
+            packet.writeUInt32LE(r.consumed, 4);
+            r.data.copy(packet, 8);
+            packet_id = "compressed";
+            length = r.consumed;
+        }
+    }
+
+    if (!packet)
+    {
+        packet = Buffer.alloc(raw_length + 8);
+        packet.writeUInt32LE(addr, 0);
+        packet.writeUInt32LE(raw_length, 4);
+        buf.copy(packet, 8, start, start + raw_length);
+    }
+
+    recordProgramData(stats, addr, buf.subarray(start, start + length));
+
+    // Send it
+    for (let i=0; i<cl.stress; i++)
+    {
+        // Update byte counts
+        stats.programBytesSent += length;
+        stats.wireBytesSent += packet.length;
+
+        // Send it
+        if (packet_id == "compressed")
+            await layer.sendDataCompressed(packet);
+        else
+            await layer.sendData(packet);
+        process.stdout.write('.');
+    }
+
+    return length;
+}
+
+// Send a chunk of gathered, non-contiguous hex file data as a single 
+// multi-segment data packet
+async function sendProgramSegments(ctx, stats, segment, record)
+{
+    let cl = ctx.cl;
+    let layer = ctx.layer;
+
+    // Copy the chunk (the chunker re-uses its buffer) and fill in the
+    // segment headers
+    let packet = Buffer.from(record.data);
+    let length = 0;
+    for (let seg of record.segments)
+    {
+        packet.writeUInt32LE(seg.addr + segment, seg.offset - 8);
+        packet.writeUInt32LE(seg.length, seg.offset - 4);
+        length += seg.length;
+        recordProgramData(stats, seg.addr + segment, record.data.subarray(seg.offset, seg.offset + seg.length));
+    }
+
+    // Just collecting program data?
+    if (stats.collectOnly)
+        return;
+
+    // Send it
+    for (let i=0; i<cl.stress; i++)
+    {
+        stats.programBytesSent += length;
+        stats.wireBytesSent += packet.length;
+        await layer.sendDataMulti(packet);
+        process.stdout.write('.');
+    }
+}
+
+// Check the CRC of each region of device memory written matches the
+// program data that was sent.  Small regions are batched into a single
+// memory CRC request.
+async function verifyProgramData(ctx, stats)
+{
+    let layer = ctx.layer;
+
     // Capture start time
     let startTime = new Date().getTime();
 
-    process.stdout.write(`Sending '${hexFile}':\n`)
+    process.stdout.write(`Verifying ${stats.regions.length} region(s)...`);
+
+    // Current batch
+    let ranges = [];
+    let batchLength = 0;
+    let crc = crc32.start();
+
+    // Send the current batch and check the result
+    async function flushBatch()
+    {
+        if (ranges.length == 0)
+            return;
 
-    // parse and re-chunk hex file and send
+        let deviceCrc = await layer.sendMemoryCrc(ranges);
+        if (deviceCrc != crc32.finish(crc))
+        {
+            let first = ranges[0];
+            let last = ranges[ranges.length - 1];
+            throw new Error(`Verify failed, device memory in range 0x${first.addr.toString(16)}-0x${(last.addr + last.length).toString(16)} doesn't match`);
+        }
+
+        ranges = [];
+        batchLength = 0;
+        crc = crc32.start();
+    }
+
+    for (let region of stats.regions)
+    {
+        let data = Buffer.concat(region.parts);
+        for (let offset = 0; offset < data.length; )
+        {
+            // Add as much as will fit to the batch
+            let length = Math.min(max_verify_block - batchLength, data.length - offset);
+            ranges.push({ addr: region.addr + offset, length });
+            crc = crc32.update_buffer(crc, data, offset, offset + length);
+            batchLength += length;
+            offset += length;
+
+            // Batch full?
+            if (batchLength >= max_verify_block || (ranges.length + 1) * 8 > layer.max_packet_size)
+                await flushBatch();
+        }
+    }
+    await flushBatch();
+
+    let elapsedTime = Math.max(1, new Date().getTime() - startTime) / 1000;
+    process.stdout.write(` ok (${elapsedTime.toFixed(1)} seconds)\n`);
+}
+
+// Send all of the collected program data
+async function sendCollectedProgramData(ctx, stats)
+{
+    // Stop collecting
+    let regions = stats.regions;
+    stats.regions = null;
+    stats.collectOnly = false;
+
+    for (let region of regions)
+    {
+        let data = Buffer.concat(region.parts);
+        region.parts = [ data ];
+        for (let offset = 0; offset < data.length; )
+        {
+            offset += await sendProgramData(ctx, stats, region.addr + offset, data, offset, data.length);
+        }
+    }
+
+    // Restore regions for verification
+    stats.regions = regions;
+}
+
+// Work out the name of the device's SD card cache entry for the 
+// collected program data (a hash of its addresses and content)
+function cacheEntryName(stats)
+{
+    let hash = crypto.createHash('sha256');
+    for (let region of stats.regions)
+    {
+        let header = Buffer.alloc(8);
+        header.writeUInt32LE(region.addr, 0);
+        header.writeUInt32LE(region.length, 4);
+        hash.update(header);
+        for (let part of region.parts)
+            hash.update(part);
+    }
+    return hash.digest('hex').substring(0, 16);
+}
+
+// Send only the blocks of the collected program data that differ from 
+// what's already in device memory (eg: from before a warm reboot)
+async function sendChangedProgramData(ctx, stats)
+{
+    let layer = ctx.layer;
+
+    // Stop collecting
+    let regions = stats.regions;
+    stats.regions = null;
+    stats.collectOnly = false;
+
+    // Split the program data into blocks
+    let blocks = [];
+    for (let region of regions)
+    {
+        let data = Buffer.concat(region.parts);
+        region.parts = [ data ];
+        for (let offset = 0; offset < data.length; offset += delta_block_size)
+        {
+            blocks.push({ 
+                addr: region.addr + offset, 
+                length: Math.min(delta_block_size, data.length - offset),
+                data, 
+                offset,
+            });
+        }
+    }
+
+    // Get the CRCs of the blocks from the device, as many per request 
+    // as will fit in the request and response packets
+    let max_blocks = Math.floor((layer.max_packet_size - 4) / 8);
+    for (let i = 0; i < blocks.length; i += max_blocks)
+    {
+        let batch = blocks.slice(i, i + max_blocks);
+        let crcs = await layer.sendBlockCrc(batch);
+        for (let j = 0; j < batch.length; j++)
+        {
+            let block = batch[j];
+            block.changed = crcs[j] != crc32.buffer(block.data.subarray(block.offset, block.offset + block.length));
+        }
+    }
+
+    // Send each run of changed blocks
+    for (let i = 0; i < blocks.length; i++)
+    {
+        let block = blocks[i];
+        if (!block.changed)
+        {
+            stats.unchangedBytes += block.length;
+            continue;
+        }
+
+        // Merge with following changed blocks from the same region
+        let end = block.offset + block.length;
+        while (i + 1 < blocks.length && blocks[i + 1].changed && blocks[i + 1].data == block.data)
+        {
+            i++;
+            end = blocks[i].offset + blocks[i].length;
+        }
+
+        for (let offset = block.offset; offset < end; )
+        {
+            offset += await sendProgramData(ctx, stats, block.addr + offset - block.offset, block.data, offset, end);
+        }
+    }
+
+    // Restore regions for verification
+    stats.regions = regions;
+}
+
+// Send an image file to the device and return its start address
+async function sendImageFile(ctx, ping)
+{
+    let cl = ctx.cl;
+    let layer = ctx.layer;
+    let imageFile = cl.imagefile;
+
+    // Capture start time
+    let startTime = new Date().getTime();
+
+    process.stdout.write(`Sending '${imageFile.filename}':\n`)
+
+    // When only sending changes or using the device's cache, collect all
+    // the program data first
+    let stats = { 
+        programBytesSent: 0, 
+        wireBytesSent: 0, 
+        unchangedBytes: 0,
+        regions: (cl.verify || cl.delta || cl.cache) ? [] : null,
+        collectOnly: cl.delta || cl.cache,
+    };
+
+    // Send file
+    let startAddress;
+    if (imageFile.kind == "hex")
+        startAddress = await sendHexFile(ctx, stats, imageFile.filename);
+    else if (imageFile.kind == "elf")
+        startAddress = await sendElfFile(ctx, stats, imageFile.filename);
+    else
+        startAddress = await sendImgFile(ctx, stats, imageFile.filename, ping.aarch);
+
+    // Try loading it from the device's SD card cache
+    let cacheName = null;
+    let cached = false;
+    if (cl.cache)
+    {
+        cacheName = cacheEntryName(stats);
+        cached = await layer.sendCacheLoad(cacheName);
+    }
+
+    // Send the collected program data (or just the changed blocks)
+    if (cached)
+    {
+        let elapsedTime = Math.max(1, new Date().getTime() - startTime) / 1000;
+        process.stdout.write(`Loaded from device's SD card cache (${cacheName}) in ${elapsedTime.toFixed(1)} seconds.\n`);
+    }
+    else
+    {
+        if (cl.delta)
+            await sendChangedProgramData(ctx, stats);
+        else if (stats.collectOnly)
+            await sendCollectedProgramData(ctx, stats);
+
+        // Wait for all data to be acknowledged
+        await layer.flush();
+
+        // Show summary
+        showSummary(stats, startTime);
+    }
+
+    // Verify (always when only sending changes)
+    if (cl.verify || cl.delta)
+        await verifyProgramData(ctx, stats);
+
+    // Store it in the device's cache
+    if (cl.cache && !cached)
+    {
+        await layer.sendCacheStore(cacheName, cl.cacheSize * 1024 * 1024);
+        process.stdout.write(`Stored in device's SD card cache (${cacheName}).\n`);
+    }
+
+    return startAddress;
+}
+
+// Show transfer summary
+function showSummary(stats, startTime)
+{
+    let elapsedTime = Math.max(1, new Date().getTime() - startTime) / 1000;
+    process.stdout.write(`\nTransfered ${stats.programBytesSent} bytes (${stats.wireBytesSent} on the wire) in ${elapsedTime.toFixed(1)} seconds.\n`);
+    process.stdout.write(`Effective rate ${Math.round(stats.programBytesSent / elapsedTime)} bytes/s, wire rate ${Math.round(stats.wireBytesSent / elapsedTime)} bytes/s.\n`);
+    if (stats.unchangedBytes)
+        process.stdout.write(`Skipped ${stats.unchangedBytes} bytes already in device memory.\n`);
+}
+
+// Send a hex file to device
+async function sendHexFile(ctx, stats, hexFile)
+{
+    let cl = ctx.cl;
+    let layer = ctx.layer;
+
+    // parse and re-chunk hex file, gathering non-contiguous records into
+    // multi-segment chunks (8 byte segment header for address and length)
     let parser = intelHex.parser(hexFile);
-    let chunker = intelHex.chunker(parser, cl.packetSize, 4);
+    let chunker = intelHex.chunker(parser, layer.max_packet_size, 0, 8);
     let segment = 0;
     let eofReceived = false;
     let startAddress = null;
-    let programBytesSent = 0;
     while (true)
     {
         // Get next record
@@ -42,18 +483,19 @@ async function sendHexFile(ctx, hexFile)
             case '00':
                 // DATA
 
-                // Write the full 32-bit address to the header area
-                record.data.writeUInt32LE(record.addr + segment, 0);
-                
-                // Send it
-                for (let i=0; i<cl.stress; i++)
+                // Multiple segments?
+                if (record.segments.length > 1)
                 {
-                    // Update program byte length
-                    programBytesSent += record.data.length - 4;
+                    await sendProgramSegments(ctx, stats, segment, record);
+                    break;
+                }
 
-                    // Send it
-                    await layer.sendData(record.data);
-                    process.stdout.write('.');
+                // Send it (header area of segment not used)
+                let seg = record.segments[0];
+                for (let offset = seg.offset; offset < seg.offset + seg.length; )
+                {
+                    offset += await sendProgramData(ctx, stats, seg.addr + segment + offset - seg.offset, 
+                                record.data, offset, seg.offset + seg.length);
                 }
                 break;
 
@@ -83,7 +525,7 @@ async function sendHexFile(ctx, hexFile)
                 // Extended linear address
                 if (record.data.length != 2)
                     throw new Error("Unexpected length of '04' hex record");
-                segment = record.data.readUInt16BE(0);
+                segment = record.data.readUInt16BE(0) * 0x10000;
                 break;
 
             case '05':
@@ -108,67 +550,52 @@ async function sendHexFile(ctx, hexFile)
     if (startAddress == null)
         console.error("WARNING: Hex file didn't report a start address, assuming default");
     
-    // Show summary
-    let elapsedTime = new Date().getTime() - startTime;
-    process.stdout.write(`\nTransfered ${programBytesSent} bytes in ${((elapsedTime / 1000).toFixed(1))} seconds.\n`);
-
     // Return the start address
     return startAddress == null ? 0xFFFFFFFF : startAddress;
 }
 
 
 // Send a img file to device
-async function sendImgFile(ctx, imgFile, aarch)
+async function sendImgFile(ctx, stats, imgFile, aarch)
 {
     let cl = ctx.cl;
     let layer = ctx.layer;
 
-    // Capture start time
-    let startTime = new Date().getTime();
-
-    process.stdout.write(`Sending '${imgFile}':\n`)
-
-    // Open image file
-    let fd = fs.openSync(imgFile, `r`);
-    let buf = Buffer.alloc(cl.packetSize);
+    // Read image file
+    let image = fs.readFileSync(imgFile);
     let startAddress = (aarch == 64) ? 0x80000 : 0x8000;
-    let addr = startAddress;
-    let programBytesSent = 0;
-    while (true)
+    for (let offset = 0; offset < image.length; )
     {
-        // Read a buffer
-        let length = fs.readSync(fd, buf, 4, buf.length - 4);
-        if (length == 0)
-            break;
+        offset += await sendProgramData(ctx, stats, startAddress + offset, image, offset, image.length);
+    }
+    
+    // Return the start address
+    return startAddress;
+}
 
-        // Write the address to the header area
-        buf.writeUInt32LE(addr, 0);
+// Send the loadable segments of an elf file to device
+async function sendElfFile(ctx, stats, elfFileName)
+{
+    let cl = ctx.cl;
+    let layer = ctx.layer;
 
-        
-        // Send it
-        for (let i=0; i<cl.stress; i++)
+    // Read program headers
+    let elf = elfFile.read(elfFileName);
+    for (let seg of elf.segments)
+    {
+        // Send file backed data
+        for (let offset = 0; offset < seg.data.length; )
         {
-            // Update program byte length
-            programBytesSent += length;
-
-            // Send it
-            await layer.sendData(buf.slice(0, length + 4));
-            process.stdout.write('.');
+            offset += await sendProgramData(ctx, stats, seg.addr + offset, seg.data, offset, seg.data.length);
         }
 
-        // Update address
-        addr += length;
+        // Zero fill the rest (eg: bss)
+        if (seg.memsz > seg.data.length)
+            await sendFill(ctx, stats, seg.addr + seg.data.length, seg.memsz - seg.data.length, 0);
     }
 
-    // Close file
-    fs.closeSync(fd);
-    
-    // Show summary
-    let elapsedTime = new Date().getTime() - startTime;
-    process.stdout.write(`\nTransfered ${programBytesSent} bytes in ${((elapsedTime / 1000).toFixed(1))} seconds.\n`);
-
     // Return the start address
-    return startAddress;
+    return elf.entry;
 }
 
 // Check the filename name looks like the right kernel image for the device
@@ -218,7 +645,7 @@ function checkKernel(ping, filename)
     // Log and quit
     console.error("\nImage name mismatch");
     console.error(`    - image file: ${path.basename(filename)}`);
-    console.error(`    - expected: ${allowedKernelNames.map(x=> x + "[img|hex]").join(" or ")} (for rpi${ping.raspi}-aarch${ping.aarch})`);
+    console.error(`    - expected: ${allowedKernelNames.map(x=> x + "[img|hex|elf]").join(" or ")} (for rpi${ping.raspi}-aarch${ping.aarch})`);
     console.error("");
     throw new Error("Aborting.  Use '--no-kernel-check' to override.");
 }
@@ -231,7 +658,7 @@ async function run(ctx)
 
     if (cl.imagefile == null && !cl.bootloader)
     {
-        throw new Error("Missing argument: .img or .hex file to flash (or --bootloader)")
+        throw new Error("Missing argument: .img, .hex or .elf file to flash (or --bootloader)")
     }
 
     if (cl.imagefile && cl.bootloader)
@@ -302,10 +729,7 @@ async function run(ctx)
     await layer.boost(cl);
 
     // Send file
-    if (cl.imagefile.kind == "hex")
-        startAddress = await sendHexFile(ctx, cl.imagefile.filename);
-    else
-        startAddress = await sendImgFile(ctx, cl.imagefile.filename, ping.aarch);
+    startAddress = await sendImageFile(ctx, ping);
 
     // Send go command
     if (!cl.noGo)
@@ -337,14 +761,16 @@ export default {
     spec: [
         {
             name: "--imagefile:<file>|-i",
-            help: "The .hex or .img file to write\n'--imagefile:' prefix not required for *.img or *.hex",
-            valuePattern: /\.(hex|img)$/,
+            help: "The .hex, .img or .elf file to write\n'--imagefile:' prefix not required for *.img, *.hex or *.elf",
+            valuePattern: /\.(hex|img|elf)$/,
             parse: (arg) => {
                 if (arg.toLowerCase().endsWith('.hex'))
                     return { filename: arg, kind: "hex" }
                 else if (arg.toLowerCase().endsWith('.img'))
                     return { filename: arg, kind: "img" }
-                throw new Error("Image file must be a '.hex' or '.img' file");
+                else if (arg.toLowerCase().endsWith('.elf'))
+                    return { filename: arg, kind: "elf" }
+                throw new Error("Image file must be a '.hex', '.img' or '.elf' file");
             },
             default: null,
         },
@@ -372,6 +798,28 @@ export default {
             name: "--no-kernel-check",
             help: "Don't check the image filename matches expected kernel type for device",
         },
+        {
+            name: "--no-compress",
+            help: "Don't compress data packets",
+        },
+        {
+            name: "--verify",
+            help: "After uploading, check the device's memory matches the image file",
+        },
+        {
+            name: "--delta",
+            help: "Only send blocks that differ from the device's memory (eg: after a warm reboot)",
+        },
+        {
+            name: "--cache",
+            help: "Load the image from a cache on the device's SD card if there, otherwise upload and store it in the cache",
+        },
+        {
+            name: "--cache-size:<mb>",
+            help: "Maximum size of the device's SD card cache, least recently used images are removed (default=64MB)",
+            parse: commandLineParser.parse_integer(1, 4095),
+            default: 64,
+        },
         {
             name: "--stress:<n>",
             help: "Send data packets N times (for load testing)",
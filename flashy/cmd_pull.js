@@ -75,37 +75,133 @@ async function pull_file(ctx, remote_path, local_path, timestamp)
 }
 
 
-async function pull_dir(ctx, remote_path, local_path)
+// Convert FatFS date and time values to a Date
+function fatDateTime(date, time)
 {
-    if (ctx.cl.verbose)
-        console.log(`pulling directory: ${remote_path} => ${local_path}`)
+    return new Date((date >> 9) + 1980, ((date >> 5) & 0x0F) - 1, date & 0x1F,
+                    time >> 11, (time >> 5) & 0x3F, (time & 0x1F) * 2);
+}
 
-    // Read directory
-    let entries = await ctx.layer.exec_ls(ctx.cl.rwd, `ls -al ${remote_path}`);
+// Pull all the files in a remote directory matching a pattern (and the 
+// entire content of matching sub-directories) with a single request
+async function pull_many(ctx, remote_path, pattern, local_path)
+{
+    let fd = null;
+    let local_file = null;
+    let expected_offset = 0;
+    let timestamp = null;
+    let error = null;
 
-    // Create the target directory
-    if (!fs.existsSync(local_path))
-        fs.mkdirSync(local_path, {recursive: true});
-    
-    // Copy files
-    for (let e of entries)
+    // Close the current file
+    function close_file()
     {
-        if (!e.isdir)
+        if (fd !== null)
         {
-            await pull_file(ctx, 
-                argUtils.pathjoin(remote_path, e.name),
-                path.join(local_path, e.name),
-                e.mtime,
-                );
+            fs.futimesSync(fd, timestamp, timestamp);
+            fs.closeSync(fd);
+            fd = null;
+            process.stdout.write(' ok\n');
         }
-        else
+    }
+
+    // Handler for each file and directory header
+    function onHeader(buf)
+    {
+        close_file();
+        local_file = null;
+
+        // Decode header
+        let header = lib.decode("pull_header", buf);
+        let remote_file = argUtils.pathjoin(remote_path, header.filename);
+        let local_entry_path = path.join(local_path, ...header.filename.split('/'));
+        timestamp = fatDateTime(header.date, header.time);
+
+        // Directory?
+        if (header.attr & 0x10)
         {
-            await pull_dir(ctx,
-                argUtils.pathjoin(remote_path, e.name),
-                path.join(local_path, e.name)
-                );
+            if (ctx.cl.verbose)
+                console.log(`pulling directory: ${remote_file} => ${local_entry_path}`);
+            if (!fs.existsSync(local_entry_path))
+                fs.mkdirSync(local_entry_path, {recursive: true});
+            return;
+        }
+
+        if (ctx.cl.verbose)
+            console.log(`pulling file: ${remote_file} => ${local_entry_path}`);
+
+        // Open the file (skipping its data if can't)
+        try
+        {
+            fd = fs.openSync(local_entry_path, ctx.cl.noClobber ? "wx" : "w");
         }
+        catch (err)
+        {
+            error = error || err;
+            return;
+        }
+        local_file = local_entry_path;
+        expected_offset = 0;
+        process.stdout.write(`${remote_file}: `)
     }
+
+    // Handler for data
+    function onData(buf)
+    {
+        if (fd === null)
+            return;
+
+        process.stdout.write('.');
+        // Write file
+        let offset = buf.readUInt32LE(0);
+        if (expected_offset != offset)
+        {
+            error = error || new Error("File packet offset mistmatch");
+            return;
+        }
+        expected_offset += fs.writeSync(fd, buf.slice(4), 0);
+    }
+
+    // Make request
+    let r;
+    try
+    {
+        r = await ctx.layer.sendPullMany(remote_path, { pattern, recursive: true }, {
+            onHeader,
+            onData,
+        });
+    }
+    finally
+    {
+        // Check result, removing the partial file if failed
+        let failed = !r || r.readUInt32LE(0) != 0;
+        if (fd !== null && failed)
+        {
+            fs.closeSync(fd);
+            fd = null;
+            if (local_file && fs.existsSync(local_file))
+                fs.unlinkSync(local_file);
+        }
+        close_file();
+    }
+
+    let err = r.readUInt32LE(0);
+    if (err)
+        throw new Error(`failed to pull files (err: ${err})`);
+    if (error)
+        throw error;
+}
+
+async function pull_dir(ctx, remote_path, local_path)
+{
+    if (ctx.cl.verbose)
+        console.log(`pulling directory: ${remote_path} => ${local_path}`)
+
+    // Create the target directory
+    if (!fs.existsSync(local_path))
+        fs.mkdirSync(local_path, {recursive: true});
+
+    // Pull the entire directory tree
+    await pull_many(ctx, remote_path, "", local_path);
 }
 
 async function run(ctx)
@@ -116,7 +212,7 @@ async function run(ctx)
     await ctx.layer.boost(ctx.cl);
 
     // Read directory entries for specified files
-    let entries = await ctx.layer.exec_ls(ctx.cl.rwd, `ls -ald ${ctx.cl.files.join(" ")}`);
+    let entries = await ctx.layer.list_args(ctx.cl.rwd, ctx.cl.files);
 
     // Quit if nothing to do
     if (entries.length == 0)
@@ -164,9 +260,18 @@ async function run(ctx)
     if (!toStat.isDirectory())
         throw new Error(`target '${ctx.cl.to}' must be a directory when pulling multiple files`);
 
-    // Pull files
-    for (let e of entries)
+    // Pull files (with a single request for each wildcard argument)
+    for (let arg of ctx.cl.files)
     {
+        let split = argUtils.pathsplit(arg);
+        if (argUtils.pathiswild(split.name))
+        {
+            let remote_dir = split.dir ? argUtils.pathjoin(ctx.cl.rwd, split.dir) : ctx.cl.rwd;
+            await pull_many(ctx, remote_dir, split.name, ctx.cl.to);
+            continue;
+        }
+
+        let e = entries.find(x => x.name == arg);
         if (!e.isdir)
         {
             await pull_file(ctx, 
@@ -1,6 +1,7 @@
 import path from 'node:path';
 import fs from 'node:fs';
 import argUtils from './argUtils.js';
+import pushArchive from './pushArchive.js';
 import { fileURLToPath } from 'node:url';
 
 const __dirname = path.dirname(fileURLToPath(import.meta.url));
@@ -14,9 +15,15 @@ async function push_file(ctx, local_path, remote_path)
     let stat = fs.statSync(local_path);
 
     let offset = 0;
-    let buf = Buffer.alloc(ctx.layer.options.max_packet_size);
     let token = Date.now() & 0x7FFFFFFF;
 
+    // Send whole sectors in each packet where possible so the data 
+    // stays sector aligned in the device's write buffer
+    let data_size = ctx.layer.max_packet_size - 8;
+    if (data_size > 512)
+        data_size -= data_size % 512;
+    let buf = Buffer.alloc(data_size + 8);
+
     // Open the file
     let fd = fs.openSync(local_path, "r");
 
@@ -30,11 +37,8 @@ async function push_file(ctx, local_path, remote_path)
         buf.writeUInt32LE(offset, 4);
         let bytes_read = fs.readSync(fd, buf, 8, buf.length - 8, offset);
 
-        // Send it
-        let r = await ctx.layer.sendPushData(buf.subarray(0, bytes_read + 8));
-        let err = r.readUInt32LE(0);
-        if (err)
-            throw new Error(`failed to push file data (err: ${err})`);
+        // Send it (the packet layer copies the data, so buf can be reused)
+        await ctx.layer.sendPushData(buf.subarray(0, bytes_read + 8));
 
         process.stdout.write('.');
 
@@ -48,12 +52,15 @@ async function push_file(ctx, local_path, remote_path)
     // Close file
     fs.closeSync(fd);
 
+    // Wait for all data to be acknowledged
+    await ctx.layer.flush();
+
     // Setup commit
     let commit = {
         token,
         size: offset,
-        date: ((stat.mtime.getFullYear() - 1980) << 9) | ((stat.mtime.getMonth() + 1) << 5) | (stat.mtime.getDate() << 0),
-        time: (stat.mtime.getHours() << 11) | (stat.mtime.getMinutes() << 5) | (stat.mtime.getSeconds() / 2),
+        date: pushArchive.fatDate(stat.mtime),
+        time: pushArchive.fatTime(stat.mtime),
         attr: 0x20,             // AM_ARC
         overwrite: !ctx.cl.noClobber,
         name: remote_path,
@@ -74,10 +81,10 @@ async function push_file(ctx, local_path, remote_path)
     process.stdout.write(' ok\n');
 }
 
-async function push_dir(ctx, local_path, remote_path)
+async function archive_dir(ctx, archive, local_path, remote_path)
 {
-    if (ctx.cl.verbose)
-        console.log(`pushing directory: ${local_path} => ${remote_path}`);
+    // Write directory entry so it's created even if empty
+    await pushArchive.add_directory(ctx, archive, local_path, remote_path);
 
     let dir = fs.opendirSync(local_path);
     try
@@ -90,11 +97,11 @@ async function push_dir(ctx, local_path, remote_path)
             
             if (de.isDirectory())
             {
-                await push_dir(ctx, path.join(local_path, de.name), argUtils.pathjoin(remote_path, de.name));
+                await archive_dir(ctx, archive, path.join(local_path, de.name), argUtils.pathjoin(remote_path, de.name));
             }
             else
             {
-                await push_file(ctx, path.join(local_path, de.name), argUtils.pathjoin(remote_path, de.name));
+                await pushArchive.add_file(ctx, archive, path.join(local_path, de.name), argUtils.pathjoin(remote_path, de.name));
             }
         }
     }
@@ -128,7 +135,7 @@ async function run(ctx)
 
     // Work out target
     let target = argUtils.pathjoin(ctx.cl.rwd, ctx.cl.to);
-    let target_stats = await ctx.layer.exec_ls('/', `ls -ald \"${target}\"`, true);
+    let target_stats = await ctx.layer.list(target, { self: true, emptyOnError: true });
     if (target_stats.length > 1)
     {
         throw new Error(`target '${target}' matches multiple items`);
@@ -157,15 +164,17 @@ async function run(ctx)
     if (!target_stat.isdir)
         throw new Error(`target '${target}' is not a directory`);
 
-    // Expand list of files and process
+    // Stream all files and directories as a single archive
+    let archive = pushArchive.writer(ctx);
     for (let f of files)
     {
         let remote_path = argUtils.pathjoin(target, path.basename(f.relative))
         if (f.stat.isDirectory())
-            await push_dir(ctx, f.relative, remote_path);
+            await archive_dir(ctx, archive, f.relative, remote_path);
         else
-            await push_file(ctx, f.relative, remote_path);
+            await pushArchive.add_file(ctx, archive, f.relative, remote_path);
     }
+    await archive.finish();
 }
 
 export default {
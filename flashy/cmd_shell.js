@@ -139,15 +139,12 @@ async function run(ctx)
             if (lastArg.match(/[\*\?\(\)\&\|\<\>]/))
                 return [[], line];
     
-            // Work out the glob pattern by closing any pending
-            // opening quote and appending the wildcard character
-            let glob = lastArg;
-            if (lastArgInfo.pendingQuote)
-                glob += lastArgInfo.pendingQuote;
-            glob += "*";
+            // Work out the glob pattern by removing quotes and escapes
+            // and appending the wildcard character
+            let glob = lastArg.replace(/\\(.)|["']/g, "$1") + "*";
     
             // Get matching files
-            let matches = await ctx.layer.exec_ls(rwd, "ls -ald " + glob, true);
+            let matches = await ctx.layer.list_args(rwd, [ glob ], true);
     
             function escape_match(name)
             {
@@ -0,0 +1,232 @@
+import path from 'node:path';
+import fs from 'node:fs';
+import argUtils from './argUtils.js';
+import crc32 from './crc32.js';
+import pushArchive from './pushArchive.js';
+
+// List a local directory tree, returning a map of relative names 
+// (using '/' separators) to { local_path, stat }
+function list_local(local_root)
+{
+    let entries = new Map();
+    function list_dir(local_path, relative)
+    {
+        let names = fs.readdirSync(local_path).sort();
+        for (let name of names)
+        {
+            let entry_local = path.join(local_path, name);
+            let entry_relative = relative ? relative + '/' + name : name;
+            let stat = fs.statSync(entry_local);
+            entries.set(entry_relative, { local_path: entry_local, stat });
+            if (stat.isDirectory())
+                list_dir(entry_local, entry_relative);
+        }
+    }
+    list_dir(local_root, "");
+    return entries;
+}
+
+// Calculate the CRC32 of a local file
+function local_file_crc(filename)
+{
+    let fd = fs.openSync(filename, "r");
+    try
+    {
+        let buf = Buffer.alloc(1024 * 1024);
+        let crc = crc32.start();
+        while (true)
+        {
+            let bytes_read = fs.readSync(fd, buf, 0, buf.length);
+            if (bytes_read == 0)
+                break;
+            crc = crc32.update_buffer(crc, buf, 0, bytes_read);
+        }
+        return crc32.finish(crc);
+    }
+    finally
+    {
+        fs.closeSync(fd);
+    }
+}
+
+// Quote a device path as a single argument for the device's shell.  Names
+// are wrapped in double quotes the same way the interactive shell's tab
+// completion quotes a match, nothing inside is escaped.  FAT doesn't allow
+// '"' in names (and every path removed comes from the device's own listing)
+// but refuse rather than risk splitting one into several arguments.
+function quote_arg(name)
+{
+    if (name.indexOf('"') >= 0)
+        throw new Error(`can't quote '${name}' for the device shell`);
+    return `"${name}"`;
+}
+
+async function run(ctx)
+{
+    // Check source
+    let source = ctx.cl.source;
+    if (!fs.existsSync(source) || !fs.statSync(source).isDirectory())
+        throw new Error(`source '${source}' is not a directory`);
+
+    // Wait for device
+    await ctx.port.switchBaud(115200);
+    await ctx.layer.ping(ctx.cl.verbose);
+    await ctx.layer.boost(ctx.cl);
+
+    // List both sides
+    let target = argUtils.pathjoin(ctx.cl.rwd, ctx.cl.to);
+    let local_entries = list_local(source);
+    let remote_entries = new Map();
+    let remote_list = await ctx.layer.list(target, { recursive: true, emptyOnError: true });
+    remote_list.sort((a, b) => a.name < b.name ? -1 : a.name > b.name ? 1 : 0);
+    for (let e of remote_list)
+        remote_entries.set(e.name, e);
+
+    let push = [];
+    let remove = [];
+    let check = [];
+    let unchanged = 0;
+
+    // Compare each local entry with the remote
+    for (let [name, l] of local_entries)
+    {
+        let r = remote_entries.get(name);
+        let isdir = l.stat.isDirectory();
+
+        // Different type, remove the remote one first
+        if (r && r.isdir != isdir)
+        {
+            remove.push(name);
+            r = null;
+        }
+
+        if (isdir)
+        {
+            if (!r)
+                push.push(name);
+        }
+        else if (!r || r.size != l.stat.size)
+        {
+            // New or different size
+            push.push(name);
+        }
+        else if (ctx.cl.checksum || Math.abs(r.mtime.getTime() - l.stat.mtime.getTime()) >= 2000)
+        {
+            // Same size but different time (FAT times have 2 second 
+            // resolution), check content
+            check.push(name);
+        }
+        else
+        {
+            unchanged++;
+        }
+    }
+
+    // Compare the content of files that might have changed
+    if (check.length)
+    {
+        let results = await ctx.layer.sendFileCrc(check.map(x => argUtils.pathjoin(target, x)));
+        for (let i=0; i<check.length; i++)
+        {
+            if (results[i].err != 0 || results[i].crc != local_file_crc(local_entries.get(check[i]).local_path))
+                push.push(check[i]);
+            else
+                unchanged++;
+        }
+    }
+
+    // Remove remote entries that don't exist locally (but not the 
+    // content of directories that are being removed anyway)
+    if (ctx.cl.delete)
+    {
+        let removed_dirs = remove.filter(x => remote_entries.get(x).isdir);
+        for (let [name, r] of remote_entries)
+        {
+            if (local_entries.has(name) || removed_dirs.some(x => name.startsWith(x + '/')))
+                continue;
+            remove.push(name);
+            if (r.isdir)
+                removed_dirs.push(name);
+        }
+    }
+
+    // Dry run?
+    if (ctx.cl.dryRun)
+    {
+        for (let name of remove)
+            console.log(`remove: ${argUtils.pathjoin(target, name)}`);
+        for (let name of push)
+            console.log(`push: ${local_entries.get(name).local_path} => ${argUtils.pathjoin(target, name)}`);
+        console.log(`${push.length} to push, ${remove.length} to remove, ${unchanged} unchanged`);
+        return;
+    }
+
+    // Remove entries, batching names into as few commands as will fit in a packet
+    let cmd = "";
+    for (let i=0; i<=remove.length; i++)
+    {
+        let arg = i < remove.length ? ' ' + quote_arg(argUtils.pathjoin(target, remove[i])) : null;
+        if (cmd && (arg == null || cmd.length + arg.length > ctx.layer.max_packet_size - 256))
+        {
+            if (ctx.cl.verbose)
+                console.log(`removing: ${cmd}`);
+            await ctx.layer.exec_cmd(ctx.cl.rwd, "rm -rf" + cmd);
+            cmd = "";
+        }
+        if (arg)
+            cmd += arg;
+    }
+
+    // Push new and changed files as a single archive stream
+    if (push.length)
+    {
+        let archive = pushArchive.writer(ctx);
+        for (let name of push)
+        {
+            let l = local_entries.get(name);
+            if (l.stat.isDirectory())
+                await pushArchive.add_directory(ctx, archive, l.local_path, argUtils.pathjoin(target, name));
+            else
+                await pushArchive.add_file(ctx, archive, l.local_path, argUtils.pathjoin(target, name));
+        }
+        await archive.finish();
+    }
+
+    console.log(`${push.length} pushed, ${remove.length} removed, ${unchanged} unchanged`);
+}
+
+export default {
+    synopsis: "Copies changed files in a directory to the device",
+    spec: [
+        {
+            name: "<source>",
+            help: "The local directory to sync from",
+        },
+        {
+            name: "--rwd:<dir>",
+            help: "The remote working directory (ie: on the device) in which to execute the command (default = /)",
+            default: '/sd',
+        },
+        {
+            name: "--to:<target>",
+            help: "The directory on the device to sync to",
+            default: '.',
+        },
+        {
+            name: "--delete",
+            help: "Remove files on the device that don't exist locally",
+            default: false,
+        },
+        {
+            name: "--checksum|-c",
+            help: "Compare the content of all files, not just those whose time stamp differs",
+            default: false,
+        },
+        {
+            name: "--dry-run",
+            help: "Show what would be changed without changing anything",
+            default: false,
+        },
+    ],
+    run,
+}
@@ -5,7 +5,7 @@ function crc32_init()
     if (g_crcTable)
         return;
 
-    g_crcTable = [];
+    g_crcTable = new Uint32Array(256);
 
 	// This is the official polynomial used by CRC-32
 	// in PKZip, WinZip and Ethernet.
@@ -17,7 +17,7 @@ function crc32_init()
         let e = reflect(i, 8) << 24;
 		for (let j = 0; j < 8; j++)
 			e = ((e << 1) ^ (e & (1 << 31) ? ulPolynomial : 0)) >>> 0;
-        g_crcTable.push(reflect(e, 32) >>> 0);
+        g_crcTable[i] = reflect(e, 32) >>> 0;
 	}
 
     function reflect(ref, ch)
@@ -51,6 +51,20 @@ function crc32_update(crc, byte)
     return ((crc >>> 8) ^ g_crcTable[(crc & 0xFF) ^ (byte & 0xFF)]) >>> 0;
 }
 
+// Update crc with a range of bytes from a buffer
+function crc32_update_buffer(crc, buf, start, end)
+{
+    if (start === undefined)
+        start = 0;
+    if (end === undefined)
+        end = buf.length;
+    for (let i=start; i<end; i++)
+    {
+        crc = (crc >>> 8) ^ g_crcTable[(crc ^ buf[i]) & 0xFF];
+    }
+    return crc >>> 0;
+}
+
 function crc32_finish(crc)
 {
 	return (crc ^ 0xffffffff) >>> 0;
@@ -68,18 +82,14 @@ function crc32_string(str)
 
 function crc32_buffer(buf)
 {
-    let crc = crc32_start();
-    for (let i=0; i<buf.length; i++)
-    {
-        crc = crc32_update(crc, buf[i]);
-    }
-    return crc32_finish(crc);
+    return crc32_finish(crc32_update_buffer(crc32_start(), buf));
 }
 
 export default {
     start: crc32_start,
     finish: crc32_finish,
     update: crc32_update,
+    update_buffer: crc32_update_buffer,
     string: crc32_string,
     buffer: crc32_buffer,
 }
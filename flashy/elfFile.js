@@ -0,0 +1,99 @@
+///////////////////////////////////////////////////////////////////////////////////
+// Utilities for reading the loadable segments of ELF executables.
+
+import fs from 'node:fs';
+
+const PT_LOAD = 1;
+
+// Reads an ELF executable (32 or 64-bit, little endian)
+// Returns an object { entry: <int>, segments: [ ... ] }
+// where each segment is { addr: <int>, data: <buf>, memsz: <int> }
+//      addr is the segment's physical load address
+//      data is the file backed bytes of the segment
+//      memsz is the size of the segment in memory (bytes past the
+//            end of data are zero-initialized)
+function read(elfFile)
+{
+    let buf = fs.readFileSync(elfFile);
+
+    // Check header
+    if (buf.length < 52 || buf.readUInt32BE(0) != 0x7F454C46)
+        throw new Error(`'${elfFile}' is not an ELF file`);
+    if (buf[5] != 1)
+        throw new Error(`'${elfFile}' is not a little endian ELF file`);
+
+    // 32 or 64-bit?
+    let is64;
+    switch (buf[4])
+    {
+        case 1: is64 = false; break;
+        case 2: is64 = true; break;
+        default:
+            throw new Error(`'${elfFile}' has unknown ELF class ${buf[4]}`);
+    }
+
+    // Helper to read an address sized field
+    function readAddr(offset)
+    {
+        if (!is64)
+            return buf.readUInt32LE(offset);
+
+        let value = buf.readBigUInt64LE(offset);
+        if (value > 0xFFFFFFFFn)
+            throw new Error(`'${elfFile}' has addresses above 4GB`);
+        return Number(value);
+    }
+
+    // Read file header
+    let entry = readAddr(24);
+    let phoff = is64 ? readAddr(32) : readAddr(28);
+    let phentsize = buf.readUInt16LE(is64 ? 54 : 42);
+    let phnum = buf.readUInt16LE(is64 ? 56 : 44);
+
+    // Read program headers
+    let segments = [];
+    for (let i=0; i<phnum; i++)
+    {
+        let ph = phoff + i * phentsize;
+        if (ph + phentsize > buf.length)
+            throw new Error(`'${elfFile}' has truncated program headers`);
+
+        // Only interested in loadable segments
+        if (buf.readUInt32LE(ph) != PT_LOAD)
+            continue;
+
+        let offset, paddr, filesz, memsz;
+        if (is64)
+        {
+            offset = readAddr(ph + 8);
+            paddr = readAddr(ph + 24);
+            filesz = readAddr(ph + 32);
+            memsz = readAddr(ph + 40);
+        }
+        else
+        {
+            offset = readAddr(ph + 4);
+            paddr = readAddr(ph + 12);
+            filesz = readAddr(ph + 16);
+            memsz = readAddr(ph + 20);
+        }
+
+        if (offset + filesz > buf.length)
+            throw new Error(`'${elfFile}' has a truncated segment`);
+        if (memsz == 0)
+            continue;
+
+        segments.push({
+            addr: paddr,
+            data: buf.subarray(offset, offset + filesz),
+            memsz: Math.max(memsz, filesz),
+        });
+    }
+
+    return {
+        entry,
+        segments
+    }
+}
+
+export default { read };
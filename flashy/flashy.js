@@ -54,6 +54,10 @@ let command_arg_specs = [
         name: "reboot",
         help: "Sends a magic reboot string",
     },
+    {
+        name: "sync",
+        help: "Copies changed files in a directory to the device",
+    },
     {
         name: "shell",
         help: "Opens an interactive command shell"
@@ -75,7 +79,7 @@ let serial_arg_specs = [
     },
     {
         name: "--packet-size:<n>",
-        help: "Size of data chunks transmitted (default=4096)",
+        help: "Size of data chunks transmitted, up to 65536 (default=4096)",
         default: 4096,
     },
     {
@@ -83,6 +87,16 @@ let serial_arg_specs = [
         help: "Time out to receive packet ack in millis (default=300ms)",
         default: 1000,
     },
+    {
+        name: "--packet-retries:<n>",
+        help: "How many times to resend a packet that isn't acknowledged (default=5)",
+        default: 5,
+    },
+    {
+        name: "--window:<n>",
+        help: "Maximum number of data packets in flight before waiting for an ack (default=8)",
+        default: 8,
+    },
     {
         name: "--ping-timeout:<n>",
         help: "Time out to receive ping ack in millis (default=300ms)",
@@ -311,6 +325,8 @@ try
                 packet_ack_timeout: ctx.cl.packetTimeout,
                 ping_ack_timeout: ctx.cl.pingTimeout,
                 ping_attempts: ctx.cl.pingAttempts,
+                window: Math.max(1, ctx.cl.window),
+                packet_retries: ctx.cl.packetRetries,
                 check_version: !ctx.cl.noVersionCheck,
                 log: ctx.cl.verbose ? (msg) => process.stdout.write(msg) : null,
             };
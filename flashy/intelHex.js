@@ -31,6 +31,7 @@ function parser(hexFile)
     let next_state = null;
     let reclen = 0;
     let recaddr = 0;
+    let rectype = 0;
     let parsed_byte = 0;
     let checksum = 0;
 
@@ -207,18 +208,23 @@ function parser(hexFile)
 //   max_chunk_size - the maximum size of coalesced chunks (including header)
 //   header_size - an optional number of bytes to reserve at the start of each
 //                 chunk's buffer
+//   segment_header_size - if set, non-contiguous records are gathered into the
+//                 same chunk as separate segments, each preceded by this many
+//                 reserved bytes
 // If set, header_size reserves space at the start of the output buffers start for 
 // user defined header information. This can be used to save copying the resulting 
 // data buffer to another buffer for encoding and transmission.
-function chunker(parser, max_chunk_size, header_size)
+// When gathering segments, each returned '00' chunk also has a `segments` array
+// of { addr, offset, length } describing where each segment's data is in the
+// chunk's buffer.
+function chunker(parser, max_chunk_size, header_size, segment_header_size)
 {
     header_size = header_size || 0;
 
     // Buffer to coalesc records into
     let buf = Buffer.alloc(max_chunk_size);
-    let bufUsed = 0;
-    let bufAddr = 0;
-    let bufAvail = max_chunk_size - header_size;
+    let bufUsed = header_size;
+    let segments = [];
 
     // Read first record
     let r = null;
@@ -228,10 +234,13 @@ function chunker(parser, max_chunk_size, header_size)
     {
         let temp = {
             type: "00",
-            addr: bufAddr,
-            data: buf.subarray(0, header_size + bufUsed),
+            addr: segments[0].addr,
+            data: buf.subarray(0, bufUsed),
         }
-        bufUsed = 0;
+        if (segment_header_size !== undefined)
+            temp.segments = segments;
+        bufUsed = header_size;
+        segments = [];
         return temp;
     }
 
@@ -242,25 +251,38 @@ function chunker(parser, max_chunk_size, header_size)
             if (r == null)
                 r = parser.read();
             if (r == null)
+            {
+                if (segments.length != 0)
+                    return flush_buffer();
                 return null;
+            }
 
             if (r.type == '00')
             {
                 // Can we combine with previous?
-                if (bufUsed != 0 && bufAddr + bufUsed != r.addr)
+                let seg = segments.length ? segments[segments.length - 1] : null;
+                if (seg != null && seg.addr + seg.length != r.addr)
                 {
-                    return flush_buffer();
+                    // Flush unless gathering and there's room for another segment
+                    if (segment_header_size === undefined || bufUsed + segment_header_size >= max_chunk_size)
+                        return flush_buffer();
+                    seg = null;
                 }
 
-                // Setup coalesced buffer address
-                if (bufUsed == 0)
-                    bufAddr = r.addr;
+                // Start a new segment
+                if (seg == null)
+                {
+                    bufUsed += segment_header_size || 0;
+                    seg = { addr: r.addr, offset: bufUsed, length: 0 };
+                    segments.push(seg);
+                }
 
                 // Copy record into our buffer
-                let room = bufAvail - bufUsed;
+                let room = max_chunk_size - bufUsed;
                 let copy = Math.min(room, r.data.length);
-                r.data.copy(buf, header_size + bufUsed, 0, copy);
+                r.data.copy(buf, bufUsed, 0, copy);
                 bufUsed += copy;
+                seg.length += copy;
 
                 if (copy < r.data.length)
                 {
@@ -274,14 +296,14 @@ function chunker(parser, max_chunk_size, header_size)
                 }
 
                 // Buffer full?
-                if (bufUsed >= bufAvail)
+                if (bufUsed >= max_chunk_size)
                 {
                     return flush_buffer();
                 }
             }
             else
             {
-                if (bufUsed != 0)
+                if (segments.length != 0)
                     return flush_buffer();
                 
                 let temp = r;
@@ -0,0 +1,162 @@
+///////////////////////////////////////////////////////////////////////////////////
+// LZ4 block compression
+//
+// Produces raw LZ4 blocks (no frame header) for the bootloader's 
+// PACKET_ID_DATA_COMPRESSED packets.  Each block is self-contained (matches
+// only refer to data earlier in the same block).
+//
+// Compression stops once the output reaches a size limit, so the caller 
+// can fill each packet with as much input as will fit.
+
+const min_match = 4;
+const hash_bits = 14;
+const max_offset = 65535;
+
+// Last 5 bytes are always literals and last match must start 12 bytes
+// before the end of the block (as per LZ4 spec)
+const last_literals = 5;
+const match_find_limit = 12;
+
+// Number of bytes needed to encode a length field (beyond the 4 bits in
+// the token)
+function length_bytes(length)
+{
+    return length < 15 ? 0 : 1 + Math.floor((length - 15) / 255);
+}
+
+// Write an extended length
+function write_length(out, pos, length)
+{
+    length -= 15;
+    while (length >= 255)
+    {
+        out[pos++] = 255;
+        length -= 255;
+    }
+    out[pos++] = length;
+    return pos;
+}
+
+// Write a sequence (literals and optional match)
+function write_sequence(out, pos, src, literal_start, literal_length, offset, match_length)
+{
+    let token_pos = pos++;
+    let token = Math.min(literal_length, 15) << 4;
+    if (literal_length >= 15)
+        pos = write_length(out, pos, literal_length);
+    src.copy(out, pos, literal_start, literal_start + literal_length);
+    pos += literal_length;
+
+    if (match_length)
+    {
+        out[pos++] = offset & 0xFF;
+        out[pos++] = offset >> 8;
+        let ml = match_length - min_match;
+        token |= Math.min(ml, 15);
+        if (ml >= 15)
+            pos = write_length(out, pos, ml);
+    }
+
+    out[token_pos] = token;
+    return pos;
+}
+
+function hash(src, pos)
+{
+    return (Math.imul(src.readUInt32LE(pos), 2654435761) >>> (32 - hash_bits));
+}
+
+// Compress src[start..end) producing at most max_output bytes.
+// Returns { data, consumed } where consumed is the number of input
+// bytes encoded in data.
+function compress(src, start, end, max_output)
+{
+    let out = Buffer.alloc(max_output);
+    let table = new Int32Array(1 << hash_bits).fill(-1);
+    let pos = 0;
+    let anchor = start;
+    let ip = start;
+    let limit = end - match_find_limit;
+    let match_limit = end - last_literals;
+
+    while (ip < limit)
+    {
+        // Look for a match
+        let h = hash(src, ip);
+        let candidate = table[h];
+        table[h] = ip;
+        if (candidate < start || ip - candidate > max_offset || src.readUInt32LE(candidate) != src.readUInt32LE(ip))
+        {
+            ip++;
+            continue;
+        }
+
+        // Will it fit (leaving room for a final empty literal sequence)?
+        let literal_length = ip - anchor;
+        let room = max_output - pos - 1 - (1 + length_bytes(literal_length) + literal_length + 2);
+        if (room < 0)
+            break;
+
+        // Extend it (but no longer than the room left for the length)
+        let max_length = min_match + 14 + 255 * room;
+        let length = min_match;
+        while (ip + length < match_limit && length < max_length && src[candidate + length] == src[ip + length])
+            length++;
+
+        pos = write_sequence(out, pos, src, anchor, literal_length, ip - candidate, length);
+        ip += length;
+        anchor = ip;
+    }
+
+    // Write as many of the remaining bytes as literals as will fit
+    let literal_length = Math.min(end - anchor, max_output - pos - 1);
+    while (literal_length > 0 && 1 + length_bytes(literal_length) + literal_length > max_output - pos)
+        literal_length--;
+    pos = write_sequence(out, pos, src, anchor, literal_length, 0, 0);
+
+    return {
+        data: out.subarray(0, pos),
+        consumed: anchor + literal_length - start,
+    }
+}
+
+// Decompress a block (for testing)
+function decompress(src, length)
+{
+    let out = Buffer.alloc(length);
+    let p = 0;
+    let op = 0;
+    while (p < src.length)
+    {
+        let token = src[p++];
+        let literal_length = token >> 4;
+        if (literal_length == 15)
+        {
+            let b;
+            do { b = src[p++]; literal_length += b; } while (b == 255);
+        }
+        src.copy(out, op, p, p + literal_length);
+        op += literal_length;
+        p += literal_length;
+        if (p >= src.length)
+            break;
+
+        let offset = src[p] | (src[p + 1] << 8);
+        p += 2;
+        let match_length = token & 0x0F;
+        if (match_length == 15)
+        {
+            let b;
+            do { b = src[p++]; match_length += b; } while (b == 255);
+        }
+        match_length += min_match;
+        for (let i=0; i<match_length; i++, op++)
+            out[op] = out[op - offset];
+    }
+    return out.subarray(0, op);
+}
+
+export default {
+    compress,
+    decompress,
+}
@@ -103,13 +103,106 @@ function packet_encode(callback, seq, cmd, buf)
     }
 }
 
+// Helper to write a run of bytes inserting stuffing bytes. If out is
+// null, nothing is written but the CRC is still calculated (used to 
+// work out the encoded length).  ctx holds the current signal byte
+// count and CRC.  Returns the updated output position.
+function write_run(ctx, src, out, pos)
+{
+    let i = 0;
+    while (i < src.length)
+    {
+        // Copy everything up to the next signal byte
+        let next = src.indexOf(signal_byte, i);
+        if (next < 0)
+            next = src.length;
+        if (next > i)
+        {
+            if (out)
+                src.copy(out, pos, i, next);
+            else
+                ctx.crc = crc32.update_buffer(ctx.crc, src, i, next);
+            pos += next - i;
+            ctx.signal_bytes = 0;
+            i = next;
+            if (i == src.length)
+                break;
+        }
+
+        // Write the signal byte
+        if (out)
+            out[pos] = signal_byte;
+        else
+            ctx.crc = crc32.update(ctx.crc, signal_byte);
+        pos++;
+        i++;
+
+        // Stuff it?
+        if (ctx.signal_bytes == 1)
+        {
+            if (out)
+                out[pos] = stuff_byte;
+            else
+                ctx.crc = crc32.update(ctx.crc, stuff_byte);
+            pos++;
+            ctx.signal_bytes = 0;
+        }
+        else
+        {
+            ctx.signal_bytes++;
+        }
+    }
+    return pos;
+}
+
+// Encode a single packet of data, returning a buffer of exactly the
+// encoded length.  Produces the same output as packet_encode but works
+// on runs of bytes instead of making callbacks for each byte.
+function packet_encode_buffer(seq, cmd, buf)
+{
+    let buflen = buf ? buf.length : 0;
+
+    // Header bytes
+    let header = [ separator_byte ];
+    let push = (b) => header.push(b);
+    var_len_enc(seq, push);
+    var_len_enc(cmd, push);
+    var_len_enc(buflen, push);
+    header = Buffer.from(header);
+
+    // First pass, calculate the CRC and encoded length of the packet body
+    let ctx = { crc: crc32.start(), signal_bytes: 0 };
+    let length = write_run(ctx, header, null, 3);
+    if (buflen)
+        length = write_run(ctx, buf, null, length);
+
+    // Trailer bytes
+    let trailer = Buffer.alloc(4);
+    trailer.writeUInt32BE(crc32.finish(ctx.crc), 0);
+    length = write_run(ctx, trailer, null, length) + 1;
+
+    // Second pass, write it
+    let out = Buffer.allocUnsafe(length);
+    out[0] = signal_byte;
+    out[1] = signal_byte;
+    out[2] = signal_byte;
+    ctx.signal_bytes = 0;
+    let pos = write_run(ctx, header, out, 3);
+    if (buflen)
+        pos = write_run(ctx, buf, out, pos);
+    pos = write_run(ctx, trailer, out, pos);
+    out[pos] = terminator_byte;
+    return out;
+}
+
 // Packet decoder
 // callback - a function(seq, cmd, buf) to be called with decoded packets
 // error - a function(mgs) to be called with error messages
 // maxlength - max length of a data packet (to prevent over allocating memory
 //             on receipt of a bad packet before it can be validated via CRC)
 // Returns - a function(byte) that should be called with individual data stream
-//           bytes.
+//           bytes.  The returned function also has a receive_buffer(buf) 
+//           method to decode a chunk of received data.
 function packet_decoder(callback, error, maxlength)
 {
     maxlength = maxlength || 1024;
@@ -135,7 +228,7 @@ function packet_decoder(callback, error, maxlength)
 
 
 
-    return function receive_byte(data)
+    function receive_byte(data)
     {
         //process.stdout.write(`0x${data.toString(16)}, `)
         // Monitoring for signal happens even while decoding packets
@@ -291,9 +384,48 @@ function packet_decoder(callback, error, maxlength)
             break;
         }
     }
+
+    // Decode a chunk of received data
+    receive_byte.receive_buffer = function(data)
+    {
+        let i = 0;
+        while (i < data.length)
+        {
+            // Fast path for packet payload, copy everything up to the next
+            // signal byte (which needs the state machine for stuffing)
+            if (state == "expect_data" && signal_bytes_seen == 0)
+            {
+                let end = Math.min(data.length, i + length - count);
+                let next = data.subarray(i, end).indexOf(signal_byte);
+                if (next >= 0)
+                    end = i + next;
+
+                if (end > i)
+                {
+                    data.copy(buf, count, i, end);
+                    crcCalc = crc32.update_buffer(crcCalc, data, i, end);
+                    count += end - i;
+                    i = end;
+
+                    if (count == length)
+                    {
+                        state = "expect_crc";
+                        count = 0;
+                    }
+                    continue;
+                }
+            }
+
+            // Slow path
+            receive_byte(data[i++]);
+        }
+    }
+
+    return receive_byte;
 }
 
 export default {
     encode: packet_encode,
+    encode_buffer: packet_encode_buffer,
     decode: packet_decoder,
 }
\ No newline at end of file
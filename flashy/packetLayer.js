@@ -9,6 +9,7 @@ import packenc from './packetEncoder.js';
 import piModel from './piModel.js';
 import RestartableTimeout from './restartableTimeout.js';
 import struct from './struct.js';
+import argUtils from './argUtils.js';
 
 import { fileURLToPath } from 'node:url';
 const __dirname = path.dirname(fileURLToPath(import.meta.url));
@@ -28,6 +29,24 @@ const PACKET_ID_PULL_HEADER = 10;
 const PACKET_ID_PULL_DATA = 11;
 const PACKET_ID_PUSH_DATA = 12;
 const PACKET_ID_PUSH_COMMIT = 13;
+const PACKET_ID_NAK = 14;
+const PACKET_ID_DATA_COMPRESSED = 15;
+const PACKET_ID_FILL = 16;
+const PACKET_ID_DATA_MULTI = 17;
+const PACKET_ID_MEMORY_CRC = 18;
+const PACKET_ID_BLOCK_CRC = 19;
+const PACKET_ID_CACHE_LOAD = 20;
+const PACKET_ID_CACHE_STORE = 21;
+const PACKET_ID_LIST = 22;
+const PACKET_ID_LIST_DATA = 23;
+const PACKET_ID_PULL_MANY = 24;
+const PACKET_ID_PUSH_ARCHIVE = 25;
+const PACKET_ID_FILE_CRC = 26;
+
+const LIST_FLAG_RECURSIVE = 0x01;
+const LIST_FLAG_SELF = 0x02;
+
+const PULL_MANY_FLAG_RECURSIVE = 0x01;
 
 let lib = struct.library();
 lib.defineType({
@@ -62,6 +81,13 @@ lib.defineType({
         "uint32le max_cpu_freq",
     ]    
 });
+lib.defineType({
+    name: "memory_crc_ack",
+    fields: [
+        "int32le err",
+        "uint32le crc",
+    ]
+});
 lib.defineType({
     name: "push_commit",
     fields: [
@@ -126,6 +152,10 @@ function layer(port, options)
         ping_ack_timeout: 300,
         ping_attempts: 10,
         check_version: true,
+        window: 1,
+        packet_retries: 5,
+        min_rto: 50,
+        max_rto: 8000,
     }, options || {})
 
     // Get log to local var
@@ -134,21 +164,100 @@ function layer(port, options)
     // Callback to be invoked on receipt of ack packet
     let ack_notify = null;
 
+    // Callback to resend the current (non-windowed) packet on receipt of nak
+    let nak_resend = null;
+
     // Timer, restarted on each packet received
     let timeout = null;
 
     // Callback for pull handler
     let stdio_handler = null;
     let pull_handler = null;
-
-    // Buffer for output of encoder (will be grown as necessary)
-    let encBuffer = Buffer.alloc(1024);
+    let list_handler = null;
 
     // Next sequence number
     let next_seq = 101;
     let current_seq = -1;
-    
-    
+
+    // Packets sent in windowed mode and not yet acknowledged (oldest first)
+    let window = [];
+
+    // Number of packets allowed in flight (as granted by device)
+    let window_size = 1;
+
+    // Maximum packet size the device will accept (until a larger
+    // size is negotiated by switchBaud the device uses 4096)
+    let packet_size = Math.min(options.max_packet_size, 4096);
+
+    // Error that aborted the windowed transfer
+    let window_error = null;
+
+    // Callback to be invoked when the window state changes
+    let window_notify = null;
+
+    // Sequence number of first packet last resent because of a gap
+    let window_resent_seq = -1;
+
+    // Round trip time estimates keyed by packet type and size
+    let rtt_estimates = new Map();
+
+    // Time in millis to transmit a number of bytes at the current baud rate
+    function wire_time(bytes)
+    {
+        return bytes * 10 * 1000 / (port.baudRate || 115200);
+    }
+
+    // Estimates are kept per packet type and power of 2 size bucket
+    function rtt_key(cmd, length)
+    {
+        return `${cmd}:${Math.floor(Math.log2(length + 1))}`;
+    }
+
+    // Update the round trip time estimate for a packet type and size.  The
+    // time to transmit the packet (and anything queued ahead of it) is 
+    // removed so estimates remain valid across baud rate switches.
+    function rtt_sample(cmd, length, elapsed, wire_bytes)
+    {
+        let residual = Math.max(0, elapsed - wire_time(wire_bytes));
+        let est = rtt_estimates.get(rtt_key(cmd, length));
+        if (!est)
+        {
+            rtt_estimates.set(rtt_key(cmd, length), { srtt: residual, rttvar: residual / 2 });
+        }
+        else
+        {
+            // Jacobson/Karels
+            est.rttvar = 0.75 * est.rttvar + 0.25 * Math.abs(est.srtt - residual);
+            est.srtt = 0.875 * est.srtt + 0.125 * residual;
+        }
+    }
+
+    // Work out the retransmission timeout for a packet, doubling on each 
+    // retry.  Before any samples have been taken, the packet ack timeout
+    // option is used.
+    function packet_rto(cmd, length, attempt, wire_bytes)
+    {
+        let est = rtt_estimates.get(rtt_key(cmd, length));
+        let rto = est ? Math.max(options.min_rto, est.srtt + 4 * est.rttvar) : options.packet_ack_timeout;
+        rto += wire_time(wire_bytes === undefined ? length : wire_bytes);
+        return Math.min(rto * Math.pow(2, attempt), Math.max(options.max_rto, options.packet_ack_timeout));
+    }
+
+    // Check if a (non-windowed) packet can safely be sent to the device 
+    // more than once
+    function is_idempotent(cmd)
+    {
+        switch (cmd)
+        {
+            case PACKET_ID_PING:
+            case PACKET_ID_PUSH_COMMIT:
+            case PACKET_ID_MEMORY_CRC:
+            case PACKET_ID_BLOCK_CRC:
+            case PACKET_ID_FILE_CRC:
+                return true;
+        }
+        return false;
+    }
     
     // Receive packets
     function onPacket(seq, cmd, data)
@@ -164,7 +273,9 @@ function layer(port, options)
 
             case PACKET_ID_ACK:
                 //console.log(`Ack: seq${seq}`);
-                if (ack_notify)
+                if (window.length)
+                    window_ack(seq, data);
+                else if (ack_notify)
                     ack_notify(seq, data);
                 break;
 
@@ -172,6 +283,10 @@ function layer(port, options)
                 console.error(`\nDevice packet error: ${data.readInt32LE(0)}`);
                 break;
 
+            case PACKET_ID_NAK:
+                onNak(data.readInt32LE(0), data.readUInt32LE(4));
+                break;
+
             case PACKET_ID_STDERR:
                 if (stdio_handler)
                     stdio_handler.onStdErr(data);
@@ -196,20 +311,225 @@ function layer(port, options)
                     pull_handler.onData(data);
                 break;
 
+            case PACKET_ID_LIST_DATA:
+                if (list_handler && seq == current_seq)
+                    list_handler(data);
+                break;
+
             default:
                 console.error(`\nUnknown packet: seq#:${seq} cmd:${cmd} len: ${data.length}`);
                 break;
         }
     }
 
+    // Device failed to decode a packet, retransmit from the packet it expected
+    function onNak(code, expected_seq)
+    {
+        log && log(`\nDevice packet error: ${code} (expected seq#${expected_seq})\n`);
+
+        if (window.length)
+        {
+            // Everything before the expected packet has been received
+            window_release(expected_seq - 1);
+
+            // Resend from the expected packet
+            if (window.length && window[0].seq == expected_seq && !window_error)
+                resend_window();
+        }
+        else if (nak_resend && expected_seq == current_seq)
+        {
+            nak_resend();
+        }
+    }
+
     // Log packet decode errors
     function onPacketError(err)
     {
         console.error(`\nPacket decode error: ${err}`);
     }
 
+    // Wait for the window state to change
+    function window_changed()
+    {
+        return new Promise((resolve) => window_notify = resolve);
+    }
+
+    // Notify window state change
+    function notify_window()
+    {
+        if (window_notify)
+        {
+            let temp = window_notify;
+            window_notify = null;
+            temp();
+        }
+    }
+
+    // Abort the windowed transfer
+    function fail_window(err)
+    {
+        if (!window_error)
+            window_error = err;
+        if (timeout)
+        {
+            timeout.cancel();
+            timeout = null;
+        }
+        notify_window();
+    }
+
+    // Throw (and clear) the error that aborted a windowed transfer
+    function check_window_error()
+    {
+        if (window_error)
+        {
+            let err = window_error;
+            window = [];
+            window_error = null;
+            window_resent_seq = -1;
+            throw err;
+        }
+    }
+
+    // Resend all unacknowledged packets (go-back-n)
+    function resend_window()
+    {
+        window_resent_seq = window[0].seq;
+        for (let p of window)
+        {
+            p.retransmitted = true;
+            port.write(p.encoded).catch(fail_window);
+        }
+    }
+
+    // Retransmission timeout for the oldest packet in the window, allowing
+    // for everything else in the window that's queued for sending
+    function window_rto()
+    {
+        let bytes = window.reduce((acc, p) => acc + p.encoded.length, 0);
+        return packet_rto(window[0].cmd, window[0].encoded.length, window[0].attempts, bytes);
+    }
+
+    // No progress on the window, resend it or give up
+    function window_timeout()
+    {
+        if (window[0].attempts < options.packet_retries)
+        {
+            window[0].attempts++;
+            log && log(`\nTimeout awaiting ack for seq#${window[0].seq}, resending (attempt ${window[0].attempts})\n`);
+            resend_window();
+            timeout.restart(window_rto());
+            return;
+        }
+
+        timeout = null;
+        fail_window(new Error("timeout awaiting response"));
+    }
+
+    // Remove all packets up to and including seq from the window
+    function window_release(seq)
+    {
+        let acked = 0;
+        while (window.length && window[0].seq <= seq)
+        {
+            // Update round trip estimate (but not from retransmitted
+            // packets since we can't tell which copy was acked)
+            let p = window.shift();
+            if (p.seq == seq && !p.retransmitted)
+                rtt_sample(p.cmd, p.encoded.length, performance.now() - p.sent, p.queued);
+            acked++;
+        }
+
+        if (acked)
+        {
+            window_resent_seq = -1;
+            if (timeout)
+            {
+                if (window.length == 0)
+                {
+                    timeout.cancel();
+                    timeout = null;
+                }
+                else
+                {
+                    timeout.restart(window_rto());
+                }
+            }
+            notify_window();
+        }
+
+        return acked;
+    }
+
+    // Handle a (cumulative) ack for windowed packets
+    function window_ack(seq, data)
+    {
+        // Ignore stale acks
+        if (seq < window[0].seq - 1)
+            return;
+
+        // Device rejected a packet?
+        if (seq >= window[0].seq && data.length >= 4 && data.readInt32LE(0) != 0)
+        {
+            fail_window(new Error(`packet rejected by device (err: ${data.readInt32LE(0)})`));
+            return;
+        }
+
+        // Remove acknowledged packets
+        if (window_release(seq))
+            return;
+
+        // Duplicate ack means the device saw a gap, resend from
+        // there (but only once as every packet after the gap will 
+        // generate another duplicate ack).
+        if (window_resent_seq != window[0].seq)
+            resend_window();
+    }
+
+    // Send a packet without waiting for its ack.  Once the window is full
+    // this waits for the device to ack the oldest packet.  Call flush() 
+    // to wait for all packets to be acknowledged.
+    async function send_windowed(cmd, buf)
+    {
+        // Wait for room in the window
+        while (window.length >= window_size && !window_error)
+            await window_changed();
+        check_window_error();
+
+        // Encode packet and add to window
+        let packet = {
+            seq: next_seq++,
+            cmd,
+            encoded: packenc.encode_buffer(next_seq - 1, cmd, buf),
+            attempts: 0,
+            retransmitted: false,
+            sent: performance.now(),
+            queued: 0,
+        };
+        window.push(packet);
+        packet.queued = window.reduce((acc, p) => acc + p.encoded.length, 0);
+
+        // Start timeout, restarted each time a packet is received
+        if (!timeout)
+            timeout = new RestartableTimeout(window_timeout, window_rto());
+
+        // Send it
+        await port.write(packet.encoded);
+    }
+
+    // Wait for all windowed packets to be acknowledged
+    async function flush()
+    {
+        while (window.length && !window_error)
+            await window_changed();
+        check_window_error();
+    }
+
     async function send(cmd, buf)
     {
+        // Finish any windowed transfer first
+        await flush();
+
         // Allocate sequenct number
         current_seq = next_seq++;
 
@@ -217,19 +537,30 @@ function layer(port, options)
         let promise_reject = null;
         let isResolved = false;
 
+        // Retransmit state
+        let retryable = is_idempotent(cmd);
+        let attempt = 0;
+        let retransmitted = false;
+        let sent_time = 0;
+
         // Setup a promise to receive ack packet callbacks and handle timeouts
         let ack_promise = new Promise((resolve, reject) => {
 
             // Install packet notification
             ack_notify = function(seq, data) 
             {
-                // Ignore if already timed out
-                if (isResolved)
+                // Ignore if already timed out, or a late ack for an
+                // earlier (retransmitted) packet
+                if (isResolved || seq < current_seq)
                     return;
 
                 // Check correct sequence number
                 if (seq == current_seq)
+                {
+                    if (!retransmitted)
+                        rtt_sample(cmd, encoded.length, performance.now() - sent_time, encoded.length);
                     resolve(data);
+                }
                 else
                     reject(new Error("invalid sequence number in ack response"));
             };
@@ -238,26 +569,25 @@ function layer(port, options)
         });
 
         // Encode packet
-        let enclength = 0;
-        packenc.encode(function(encbyte) {
-            // Grow buffer?
-            if (enclength >= encBuffer.length)
-            {
-                let newBuffer = Buffer.alloc(encBuffer.length + 1024);
-                encBuffer.copy(newBuffer, 0);
-                encBuffer = newBuffer;
-            }
-            // Store byte
-            encBuffer[enclength++] = encbyte;
+        let encoded = packenc.encode_buffer(current_seq, cmd, buf);
 
-        }, current_seq, cmd, buf);
+        // Packets that are safe to process twice can be resent on nak
+        // or timeout
+        function resend()
+        {
+            retransmitted = true;
+            port.write(encoded).catch(() => {});
+        }
+        if (retryable)
+            nak_resend = resend;
 
         try
         {
             ack_promise.then(() => isResolved = true).catch(() => {});
 
             // Write it and flush
-            await port.write(encBuffer.subarray(0, enclength));
+            sent_time = performance.now();
+            await port.write(encoded);
             await port.drain();
 
             // If not yet resolved, setup a timeout
@@ -265,9 +595,22 @@ function layer(port, options)
             {
                 // Install timeout
                 timeout = new RestartableTimeout(() => {
+
+                    // Retry?
+                    if (retryable && cmd != PACKET_ID_PING && attempt < options.packet_retries)
+                    {
+                        attempt++;
+                        log && log(`\nTimeout awaiting ack for seq#${current_seq}, resending (attempt ${attempt})\n`);
+                        resend();
+                        timeout.restart(packet_rto(cmd, encoded.length, attempt));
+                        return;
+                    }
+
                     timeout = null;
                     promise_reject(new Error("timeout awaiting response"));
-                }, cmd == PACKET_ID_PING ? options.ping_ack_timeout : options.packet_ack_timeout);
+                }, cmd == PACKET_ID_PING ? options.ping_ack_timeout 
+                    : retryable ? packet_rto(cmd, encoded.length, 0) 
+                    : options.packet_ack_timeout);
             }
         
             // Wait for ack or timeout
@@ -276,9 +619,11 @@ function layer(port, options)
         finally
         {
             ack_notify = null;
+            nak_resend = null;
             if (timeout)
             {
                 timeout.cancel();
+                timeout = null;
             }
             current_seq = -1;
         }
@@ -289,10 +634,7 @@ function layer(port, options)
 
     function read_handler(data)
     {
-        for (let i=0; i<data.length; i++)
-        {
-            decoder(data[i]);
-        }
+        decoder.receive_buffer(data);
     }
 
     // Read data from serial and pump it through the packet decoder
@@ -362,7 +704,7 @@ function layer(port, options)
         let cpufreq = 0;
         if ((cl.cpuBoost == "auto" && cl.baud > 1000000) || cl.cpuBoost == 'yes')
             cpufreq = last_ping_result.max_cpu_freq;
-        if (cl.baud != 115200 || cpufreq != 0)
+        if (cl.baud != 115200 || cpufreq != 0 || options.window > 1 || options.max_packet_size != packet_size)
         {
             await switchBaud(cl.baud, cl.resetTimeout, cpufreq);
             await ping();
@@ -382,21 +724,29 @@ function layer(port, options)
                 log("...");
         }
 
-        let packet = Buffer.alloc(12);
+        let packet = Buffer.alloc(20);
         packet.writeUInt32LE(baud, 0);
         packet.writeUInt32LE(reset_timeout_millis, 4);
         packet.writeUInt32LE(cpu_freq, 8);
-        await send(PACKET_ID_REQUEST_BAUD, packet);
-        log && log(" ok\n");
+        packet.writeUInt32LE(options.window, 12);
+        packet.writeUInt32LE(options.max_packet_size, 16);
+        let r = await send(PACKET_ID_REQUEST_BAUD, packet);
+
+        // Store granted window and packet size (older bootloaders don't
+        // support windows and have already been checked to support the
+        // requested packet size)
+        window_size = r.length >= 4 ? Math.max(1, r.readUInt32LE(0)) : 1;
+        packet_size = r.length >= 8 ? Math.min(options.max_packet_size, r.readUInt32LE(4)) : options.max_packet_size;
+        log && log(` ok (window: ${window_size}, packet size: ${packet_size})\n`);
     
         // Switch underlying serial transport
         await port.switchBaud(baud);
     }
 
-    // Send a data packet
+    // Send a data packet (windowed, use flush() to wait for completion)
     async function sendData(data)
     {
-        await send(PACKET_ID_DATA, data);
+        await send_windowed(PACKET_ID_DATA, data);
     }
 
     // switches the baud rate on the underlying serial connection
@@ -450,37 +800,174 @@ function layer(port, options)
         return r;
     }
 
-    async function sendPushData(data)
+    // Send a request to pull all the files in a directory (optionally 
+    // filtered by a glob pattern and including the content of matching
+    // sub-directories).  The handler's onHeader and onData are called 
+    // for each file, and onHeader for each directory.
+    async function sendPullMany(path, opts, handler)
     {
-        return await send(PACKET_ID_PUSH_DATA, data);
+        opts = opts || {};
+        log && log(`Sending pull many request ${path}...\n`);
+
+        // Set pull handler
+        pull_handler = handler;
+
+        // Send request
+        let pathBuf = Buffer.from(path + "\0", 'utf8');
+        let patternBuf = Buffer.from((opts.pattern || "") + "\0", 'utf8');
+        let packet = Buffer.concat([Buffer.alloc(1), pathBuf, patternBuf]);
+        packet.writeUInt8(opts.recursive ? PULL_MANY_FLAG_RECURSIVE : 0, 0);
+        let r;
+        try
+        {
+            r = await send(PACKET_ID_PULL_MANY, packet);
+        }
+        finally
+        {
+            // Clean up
+            pull_handler = null;
+        }
+
+        log && log(" ok\n");
+        return r;
     }
 
-    async function sendPushCommit(commit)
+    // Send a compressed data packet (windowed, use flush() to wait for completion)
+    async function sendDataCompressed(data)
     {
-        return await send(PACKET_ID_PUSH_COMMIT, lib.encode("push_commit", commit));
+        await send_windowed(PACKET_ID_DATA_COMPRESSED, data);
     }
 
-    // Parse the output of a "ls -l" output from device
-    function parse_ls_output(output)
+    // Send a fill packet (windowed, use flush() to wait for completion)
+    async function sendFill(address, length, pattern)
     {
-        let entries = [];
-        for (let l of output.split('\n'))
+        let packet = Buffer.alloc(9);
+        packet.writeUInt32LE(address, 0);
+        packet.writeUInt32LE(length, 4);
+        packet.writeUInt8(pattern, 8);
+        await send_windowed(PACKET_ID_FILL, packet);
+    }
+
+    // Send a multi-segment data packet (windowed, use flush() to wait for completion)
+    async function sendDataMulti(data)
+    {
+        await send_windowed(PACKET_ID_DATA_MULTI, data);
+    }
+
+    // Request the CRC32 of one or more ranges ({ addr, length }) of device 
+    // memory, calculated over the ranges in order
+    async function sendMemoryCrc(ranges)
+    {
+        let packet = Buffer.alloc(ranges.length * 8);
+        for (let i=0; i<ranges.length; i++)
+        {
+            packet.writeUInt32LE(ranges[i].addr, i * 8);
+            packet.writeUInt32LE(ranges[i].length, i * 8 + 4);
+        }
+        let r = lib.decode("memory_crc_ack", await send(PACKET_ID_MEMORY_CRC, packet));
+        if (r.err != 0)
+            throw new Error(`Device failed to calculate memory CRC (${r.err})`);
+        return r.crc;
+    }
+
+    // Request the CRC32 of each of a set of blocks ({ addr, length }) of
+    // device memory.  Returns an array of CRCs.
+    async function sendBlockCrc(blocks)
+    {
+        let packet = Buffer.alloc(blocks.length * 8);
+        for (let i=0; i<blocks.length; i++)
+        {
+            packet.writeUInt32LE(blocks[i].addr, i * 8);
+            packet.writeUInt32LE(blocks[i].length, i * 8 + 4);
+        }
+        let r = await send(PACKET_ID_BLOCK_CRC, packet);
+        let err = r.readInt32LE(0);
+        if (err != 0)
+            throw new Error(`Device failed to calculate block CRCs (${err})`);
+        let crcs = [];
+        for (let offset = 4; offset + 4 <= r.length; offset += 4)
+        {
+            crcs.push(r.readUInt32LE(offset));
+        }
+        return crcs;
+    }
+
+    // Ask the device to calculate the CRC32 of the content of a set of 
+    // files.  Returns an array of { err, crc }, one per file.  Names are
+    // batched into as few requests as the packet size allows.
+    async function sendFileCrc(names)
+    {
+        let results = [];
+        let pos = 0;
+        while (pos < names.length)
         {
-            let m = l.match(/^([-d][-r][-s][-h][-a])\s+(\d\d)\/(\d\d)\/(\d\d\d\d)\s+(\d\d)\:(\d\d)\:(\d\d)\s+(\d+)\s+(.*)$/);
-            if (m)
+            // Build a batch that fits in both the request and response packets
+            let bufs = [];
+            let length = 0;
+            let max_count = Math.floor((packet_size - 4) / 8);
+            while (pos < names.length && bufs.length < max_count)
             {
-                entries.push({
-                    attr: m[1],
-                    mtime: new Date(parseInt(m[4]), parseInt(m[3])-1, parseInt(m[2]), parseInt(m[5]), parseInt(m[6]), parseInt(m[7])),
-                    size: m[8],
-                    name: m[9],
-                    isdir: m[1][0] == 'd',
-                })
+                let buf = Buffer.from(names[pos] + "\0", 'utf8');
+                if (bufs.length > 0 && length + buf.length > packet_size)
+                    break;
+                bufs.push(buf);
+                length += buf.length;
+                pos++;
+            }
+
+            // Send it
+            let r = await send(PACKET_ID_FILE_CRC, Buffer.concat(bufs));
+            let err = r.readInt32LE(0);
+            if (err != 0)
+                throw new Error(`Device failed to calculate file CRCs (${err})`);
+            for (let offset = 4; offset + 8 <= r.length; offset += 8)
+            {
+                results.push({
+                    err: r.readInt32LE(offset),
+                    crc: r.readUInt32LE(offset + 4),
+                });
             }
         }
+        return results;
+    }
 
-        return entries;
+    // Ask the device to load a cached image from its SD card.  Returns 
+    // true if loaded, false if not cached (in which case the device 
+    // records the upload that follows for sendCacheStore)
+    async function sendCacheLoad(name)
+    {
+        let r = await send(PACKET_ID_CACHE_LOAD, Buffer.from(name + "\0", 'utf8'));
+        return r.readInt32LE(0) == 0;
+    }
+
+    // Ask the device to store the image uploaded since sendCacheLoad in 
+    // its SD card cache, evicting old entries to stay within max_size bytes
+    async function sendCacheStore(name, max_size)
+    {
+        let packet = Buffer.alloc(4 + Buffer.byteLength(name, 'utf8') + 1);
+        packet.writeUInt32LE(max_size, 0);
+        packet.write(name, 4, 'utf8');
+        let r = await send(PACKET_ID_CACHE_STORE, packet);
+        let err = r.readInt32LE(0);
+        if (err != 0)
+            throw new Error(`Device failed to store image in cache (${err})`);
+    }
+
+    // Send a push data packet (windowed, use flush() to wait for completion)
+    async function sendPushData(data)
+    {
+        await send_windowed(PACKET_ID_PUSH_DATA, data);
+    }
 
+    // Send a push archive packet (windowed, use flush() to wait for completion)
+    async function sendPushArchive(data)
+    {
+        await send_windowed(PACKET_ID_PUSH_ARCHIVE, data);
+    }
+
+    async function sendPushCommit(commit)
+    {
+        return await send(PACKET_ID_PUSH_COMMIT, lib.encode("push_commit", commit));
     }
 
     async function exec_cmd(rwd, cmd, suppressErrors)
@@ -513,28 +1000,127 @@ function layer(port, options)
     }
 
 
-    async function exec_ls(rwd, cmd, emptyOnError)
+    // Get a directory listing from the device.  Returns an array of 
+    // { name, size, mtime, attr, isdir } entries, with names relative
+    // to the listed directory.  Options:
+    //   recursive - also list the contents of sub-directories
+    //   self - list the path itself, not its contents
+    //   pattern - glob pattern to filter names by
+    //   emptyOnError - return an empty list rather than throwing
+    async function list(path, opts)
     {
-        let output = await exec_cmd(rwd, cmd, emptyOnError);
-        return parse_ls_output(output);
+        opts = opts || {};
+        log && log(`Sending list request ${path}...\n`);
+
+        // Encode request
+        let pathBuf = Buffer.from(path + "\0", 'utf8');
+        let patternBuf = Buffer.from((opts.pattern || "") + "\0", 'utf8');
+        let packet = Buffer.concat([Buffer.alloc(1), pathBuf, patternBuf]);
+        packet.writeUInt8((opts.recursive ? LIST_FLAG_RECURSIVE : 0) | (opts.self ? LIST_FLAG_SELF : 0), 0);
+
+        // Decode entries as they arrive
+        let entries = [];
+        list_handler = function(data)
+        {
+            let offset = 0;
+            while (offset + 9 < data.length)
+            {
+                let size = data.readUInt32LE(offset);
+                let time = data.readUInt16LE(offset + 4);
+                let date = data.readUInt16LE(offset + 6);
+                let attr = data.readUInt8(offset + 8);
+                let nameEnd = data.indexOf(0, offset + 9);
+                if (nameEnd < 0)
+                    nameEnd = data.length;
+                entries.push({
+                    name: data.toString('utf8', offset + 9, nameEnd),
+                    size,
+                    mtime: new Date((date >> 9) + 1980, ((date >> 5) & 0x0F) - 1, date & 0x1F,
+                                    time >> 11, (time >> 5) & 0x3F, (time & 0x1F) * 2),
+                    attr,
+                    isdir: (attr & 0x10) != 0,
+                });
+                offset = nameEnd + 1;
+            }
+        };
+
+        // Send request
+        let r;
+        try
+        {
+            r = await send(PACKET_ID_LIST, packet);
+        }
+        finally
+        {
+            list_handler = null;
+        }
+
+        // Check result
+        let err = r.readInt32LE(0);
+        if (err != 0)
+        {
+            if (opts.emptyOnError)
+                return [];
+            throw new Error(`Failed to list '${path}' (err: ${err})`);
+        }
+
+        return entries;
+    }
+
+    // List a set of paths (relative to rwd) the same way a shell would
+    // expand them as arguments, supporting wildcards in the last path 
+    // component.  Returned names are the paths as specified (or expanded)
+    async function list_args(rwd, args, emptyOnError)
+    {
+        let entries = [];
+        for (let arg of args)
+        {
+            // Wildcard?
+            let split = argUtils.pathsplit(arg);
+            if (argUtils.pathiswild(split.name))
+            {
+                let dirPath = split.dir ? argUtils.pathjoin(rwd, split.dir) : rwd;
+                let matches = await list(dirPath, { pattern: split.name, emptyOnError });
+                entries.push(...matches.map(x => ({ ...x, name: split.dir ? argUtils.pathjoin(split.dir, x.name) : x.name })));
+            }
+            else
+            {
+                let matches = await list(argUtils.pathjoin(rwd, arg), { self: true, emptyOnError });
+                entries.push(...matches.map(x => ({ ...x, name: arg })));
+            }
+        }
+        return entries;
     }
 
 
     // Return API
     return {
         send,
+        flush,
         ping,
         boost,
         switchBaud,
         sendData,
+        sendDataCompressed,
+        sendFill,
+        sendDataMulti,
+        sendMemoryCrc,
+        sendBlockCrc,
+        sendFileCrc,
+        sendCacheLoad,
+        sendCacheStore,
         sendGo,
         sendCommand,
         sendPull,   
+        sendPullMany,
         sendPushData,
         sendPushCommit,
+        sendPushArchive,
         exec_cmd,
-        exec_ls,
+        list,
+        list_args,
         get options() { return options; },
+        get max_packet_size() { return packet_size; },
         get port() { return port; },
     }
 
@@ -0,0 +1,165 @@
+///////////////////////////////////////////////////////////////////////////////////
+// Push archive streams - multiple files sent to the device in a single
+// continuous stream of push archive packets.
+
+import fs from 'node:fs';
+import struct from './struct.js';
+
+let lib = struct.library();
+lib.defineType({
+    name: "archive_entry",
+    fields: [
+        "uint32le size",
+        "uint16le time",
+        "uint16le date",
+        "uint8 attr",
+        "uint8 overwrite",
+        "string name",
+    ]
+});
+
+// Convert a Date to FatFS date and time values
+function fatDate(d)
+{
+    return ((d.getFullYear() - 1980) << 9) | ((d.getMonth() + 1) << 5) | (d.getDate() << 0);
+}
+
+function fatTime(d)
+{
+    return (d.getHours() << 11) | (d.getMinutes() << 5) | (d.getSeconds() >> 1);
+}
+
+// Packs file and directory entries into a push archive stream, sending
+// each packet as it fills.  The device unpacks the stream directly into
+// the final files so there's no per-file round trip.
+function archive_writer(ctx)
+{
+    let token = Date.now() & 0x7FFFFFFF;
+    let buf = Buffer.alloc(ctx.layer.max_packet_size);
+    let used = 8;
+    let offset = 0;
+
+    // Send the current packet (the packet layer copies the data, so buf can be reused)
+    async function send_packet()
+    {
+        buf.writeUInt32LE(token, 0);
+        buf.writeUInt32LE(offset, 4);
+        await ctx.layer.sendPushArchive(buf.subarray(0, used));
+        offset += used - 8;
+        used = 8;
+    }
+
+    // Append bytes to the stream
+    async function write(data)
+    {
+        let pos = 0;
+        while (pos < data.length)
+        {
+            let length = Math.min(data.length - pos, buf.length - used);
+            data.copy(buf, used, pos, pos + length);
+            used += length;
+            pos += length;
+            if (used == buf.length)
+                await send_packet();
+        }
+    }
+
+    // Append an entry header
+    async function write_entry(entry)
+    {
+        await write(lib.encode("archive_entry", entry));
+    }
+
+    // Append the content of a file, reading directly into the packet buffer
+    async function write_file(fd, size)
+    {
+        let pos = 0;
+        while (pos < size)
+        {
+            let bytes_read = fs.readSync(fd, buf, used, Math.min(size - pos, buf.length - used), pos);
+            if (bytes_read == 0)
+                throw new Error(`file changed while being pushed`);
+            used += bytes_read;
+            pos += bytes_read;
+            if (used == buf.length)
+            {
+                await send_packet();
+                process.stdout.write('.');
+            }
+        }
+    }
+
+    // Send the final partial packet and wait for everything to be acknowledged
+    async function finish()
+    {
+        if (used > 8)
+            await send_packet();
+        await ctx.layer.flush();
+    }
+
+    return {
+        write_entry,
+        write_file,
+        finish,
+    }
+}
+
+// Add a file entry and its content
+async function add_file(ctx, archive, local_path, remote_path)
+{
+    if (ctx.cl.verbose)
+        console.log(`pushing file: ${local_path} => ${remote_path}`);
+
+    // Get local file stat
+    let stat = fs.statSync(local_path);
+
+    process.stdout.write(`${local_path}: `)
+
+    // Write header
+    await archive.write_entry({
+        size: stat.size,
+        date: fatDate(stat.mtime),
+        time: fatTime(stat.mtime),
+        attr: 0x20,             // AM_ARC
+        overwrite: !ctx.cl.noClobber,
+        name: remote_path,
+    });
+
+    // Write data
+    let fd = fs.openSync(local_path, "r");
+    try
+    {
+        await archive.write_file(fd, stat.size);
+    }
+    finally
+    {
+        fs.closeSync(fd);
+    }
+
+    process.stdout.write(' ok\n');
+}
+
+// Add a directory entry, so the directory is created even if empty
+async function add_directory(ctx, archive, local_path, remote_path)
+{
+    if (ctx.cl.verbose)
+        console.log(`pushing directory: ${local_path} => ${remote_path}`);
+
+    let stat = fs.statSync(local_path);
+    await archive.write_entry({
+        size: 0,
+        date: fatDate(stat.mtime),
+        time: fatTime(stat.mtime),
+        attr: 0x10,             // AM_DIR
+        overwrite: 0,
+        name: remote_path,
+    });
+}
+
+export default {
+    fatDate,
+    fatTime,
+    writer: archive_writer,
+    add_file,
+    add_directory,
+};
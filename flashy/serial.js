@@ -207,7 +207,8 @@ function serialPort(serialPortName, options)
         write,
         read,
         writeSlow,
-        get portName() { return serialPortName } 
+        get portName() { return serialPortName },
+        get baudRate() { return serialPortOptions.baudRate },
     }
     
 }